@@ -0,0 +1,458 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: aio.h
+ *     Created: 2018-05-18 15:30
+ * Description: asynchronous reads and writes of kx::file
+ * ===================================================
+ */
+#ifndef _KX_AIO_H
+#define _KX_AIO_H
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "file.h"
+
+// A transfer is split in blocks of AIO_BLOCK bytes, at most AIO_DEPTH of
+// them in flight; the thread backend runs AIO_THREADS of them at once.
+#define AIO_BLOCK (1 << 20)
+#define AIO_DEPTH 32
+#define AIO_THREADS 4
+
+// registered buffer slots of the io_uring backend, one per transfer
+#define AIO_SLOTS 16
+
+namespace kx {
+
+// "auto" (io_uring if the kernel has it), "uring" or "threads"
+static std::string &aio_backend()
+{
+    static std::string name = "auto";
+    return name;
+}
+
+// One read or write of a whole buffer. The engine fills in the progress
+// under its lock; the buffer belongs to the engine until wait().
+struct aio_job {
+    int fd;
+    char *buf;
+    size_t size;
+    uint64_t offset;
+    bool write;
+
+    size_t issued = 0;      // bytes handed out as blocks
+    size_t done = 0;        // bytes transferred
+    int blocks = 0;         // blocks in flight
+    bool failed = false;
+    int slot = -2;          // registered buffer, -1 none, -2 not tried
+
+    bool finished() const { return issued == size && blocks == 0; }
+};
+
+struct aio_block {
+    std::shared_ptr<aio_job> job;
+    size_t pos;             // in the job
+    size_t len;
+};
+
+// Runs the blocks of submitted jobs in order of submission. Backends only
+// move blocks: next_block() hands one out, finish_block() takes its
+// result, a short transfer being retried for the rest.
+class aio_engine: private noncopyable {
+public:
+    virtual ~aio_engine() {}
+    virtual const char *name() = 0;
+
+    std::shared_ptr<aio_job> submit(int fd, void *buf, size_t size, uint64_t offset, bool write) {
+        auto job = std::make_shared<aio_job>();
+        job->fd = fd;
+        job->buf = (char *)buf;
+        job->size = size;
+        job->offset = offset;
+        job->write = write;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push_back(job);
+        }
+        work_.notify_all();
+        return job;
+    }
+
+    // the bytes transferred, fewer at the end of a file, or -1
+    size_t wait(const std::shared_ptr<aio_job> &job) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [&]() { return job->finished(); });
+        return job->failed ? -1 : job->done;
+    }
+
+protected:
+    // under mutex_
+    bool next_block(aio_block *b) {
+        while (!retry_.empty()) {
+            *b = retry_.front();
+            retry_.pop_front();
+            if (b->job->failed)
+                continue;
+            b->job->blocks++;
+            return true;
+        }
+
+        while (!jobs_.empty()) {
+            std::shared_ptr<aio_job> &job = jobs_.front();
+            if (job->issued == job->size) {
+                jobs_.pop_front();
+                continue;
+            }
+            start_job(*job);
+
+            b->job = job;
+            b->pos = job->issued;
+            b->len = std::min<size_t>(AIO_BLOCK, job->size - job->issued);
+            job->issued += b->len;
+            job->blocks++;
+            return true;
+        }
+        b->job.reset();
+        return false;
+    }
+
+    // under mutex_; res is the byte count or -errno
+    void finish_block(const aio_block &b, ssize_t res) {
+        aio_job &job = *b.job;
+        job.blocks--;
+
+        if (res == -EINTR || res == -EAGAIN) {
+            retry_.push_back(b);
+        } else if (res < 0 || (res == 0 && job.write)) {
+            job.failed = true;
+            job.issued = job.size;
+        } else if (res == 0) {
+            job.issued = job.size;          // end of file
+        } else {
+            job.done += res;
+            if ((size_t)res < b.len && !job.failed) {
+                aio_block rest = b;
+                rest.pos += res;
+                rest.len -= res;
+                retry_.push_back(rest);
+            }
+        }
+
+        if (job.finished()) {
+            end_job(job);
+            done_.notify_all();
+        }
+    }
+
+    // before the first and after the last block of a job, under mutex_
+    virtual void start_job(aio_job &job) { job.slot = -1; }
+    virtual void end_job(aio_job &job) {}
+
+    std::mutex mutex_;
+    std::condition_variable work_;
+    std::condition_variable done_;
+    std::deque<std::shared_ptr<aio_job> > jobs_;
+    std::deque<aio_block> retry_;
+    bool stop_ = false;
+};
+
+// Blocks on AIO_THREADS threads doing pread/pwrite.
+class thread_engine: public aio_engine {
+public:
+    thread_engine() {
+        for (int i=0; i<AIO_THREADS; i++)
+            threads_.push_back(std::thread([this]() { run(); }));
+    }
+
+    ~thread_engine() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        work_.notify_all();
+        for (auto &t: threads_)
+            t.join();
+    }
+
+    const char *name() { return "threads"; }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            aio_block b;
+            work_.wait(lock, [&]() { return stop_ || next_block(&b); });
+            if (!b.job)
+                break;
+
+            lock.unlock();
+            aio_job &job = *b.job;
+            ssize_t res = job.write ?
+                pwrite(job.fd, job.buf + b.pos, b.len, job.offset + b.pos) :
+                pread(job.fd, job.buf + b.pos, b.len, job.offset + b.pos);
+            if (res < 0)
+                res = -errno;
+            lock.lock();
+
+            finish_block(b, res);
+        }
+    }
+
+    std::vector<std::thread> threads_;
+};
+
+// Blocks as io_uring requests, through the raw syscalls. One thread
+// fills the submission queue with every block it may start, enters the
+// kernel once for the batch and reaps the completions. A transfer up to
+// 1 GB gets its buffer registered in a slot of a sparse table, so its
+// blocks are READ_FIXED/WRITE_FIXED and the kernel does not map the
+// pages again for every block.
+class uring_engine: public aio_engine {
+public:
+    ~uring_engine() {
+        if (thread_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            work_.notify_all();
+            thread_.join();
+        }
+        if (sq_ring_ && sq_ring_ != MAP_FAILED)
+            munmap(sq_ring_, sq_ring_size_);
+        if (cq_ring_ && cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+            munmap(cq_ring_, cq_ring_size_);
+        if (sqes_ && sqes_ != MAP_FAILED)
+            munmap(sqes_, AIO_DEPTH * sizeof(io_uring_sqe));
+        if (fd_ >= 0)
+            close(fd_);
+    }
+
+    const char *name() { return "uring"; }
+
+    // false when the kernel has no io_uring, or it is disabled
+    bool open() {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd_ = syscall(__NR_io_uring_setup, AIO_DEPTH, &p);
+        if (fd_ < 0)
+            return false;
+
+        sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+        sq_ring_ = (char *)mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                fd_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED)
+            return false;
+        cq_ring_ = sq_ring_;
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+            cq_ring_ = (char *)mmap(NULL, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd_, IORING_OFF_CQ_RING);
+            if (cq_ring_ == MAP_FAILED)
+                return false;
+        }
+        sqes_ = (io_uring_sqe *)mmap(NULL, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes_ == MAP_FAILED)
+            return false;
+
+        sq_tail_ = (unsigned *)(sq_ring_ + p.sq_off.tail);
+        sq_mask_ = *(unsigned *)(sq_ring_ + p.sq_off.ring_mask);
+        sq_array_ = (unsigned *)(sq_ring_ + p.sq_off.array);
+        cq_head_ = (unsigned *)(cq_ring_ + p.cq_off.head);
+        cq_tail_ = (unsigned *)(cq_ring_ + p.cq_off.tail);
+        cq_mask_ = *(unsigned *)(cq_ring_ + p.cq_off.ring_mask);
+        cqes_ = (io_uring_cqe *)(cq_ring_ + p.cq_off.cqes);
+
+        io_uring_rsrc_register reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.nr = AIO_SLOTS;
+        reg.flags = IORING_RSRC_REGISTER_SPARSE;
+        fixed_ = syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS2, &reg, sizeof(reg)) == 0;
+
+        thread_ = std::thread([this]() { run(); });
+        return true;
+    }
+
+private:
+    void run() {
+        std::vector<aio_block> inflight(AIO_DEPTH);
+        std::vector<int> free_ids;
+        for (int i=AIO_DEPTH-1; i>=0; i--)
+            free_ids.push_back(i);
+
+        // errno of a failed io_uring_enter, after which the ring is not
+        // used again and every block fails
+        int error = 0;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            int busy = AIO_DEPTH - free_ids.size();
+            aio_block b;
+            unsigned queued = 0;
+            if (busy == 0)
+                work_.wait(lock, [&]() { return stop_ || !jobs_.empty() || !retry_.empty(); });
+            if (stop_ && busy == 0)
+                break;
+
+            if (error) {
+                while (next_block(&b))
+                    finish_block(b, -error);
+                continue;
+            }
+
+            unsigned tail = *sq_tail_;
+            while (!free_ids.empty() && next_block(&b)) {
+                int id = free_ids.back();
+                free_ids.pop_back();
+                prepare(&sqes_[tail & sq_mask_], b, id);
+                sq_array_[tail & sq_mask_] = tail & sq_mask_;
+                inflight[id] = b;
+                tail++;
+                queued++;
+            }
+            __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+            busy = AIO_DEPTH - free_ids.size();
+            lock.unlock();
+
+            while (syscall(__NR_io_uring_enter, fd_, queued, busy ? 1 : 0, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+                if (errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+                    error = errno;
+                    break;
+                }
+            }
+
+            lock.lock();
+            unsigned head = *cq_head_;
+            unsigned end = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            for (; head != end; head++) {
+                const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+                aio_block done = inflight[cqe.user_data];
+                inflight[cqe.user_data].job.reset();
+                free_ids.push_back(cqe.user_data);
+                finish_block(done, cqe.res);
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+            // the blocks still in flight will not complete
+            for (int id=0; error && id<AIO_DEPTH; id++) {
+                if (!inflight[id].job)
+                    continue;
+                aio_block done = inflight[id];
+                inflight[id].job.reset();
+                free_ids.push_back(id);
+                finish_block(done, -error);
+            }
+        }
+    }
+
+    void prepare(io_uring_sqe *sqe, const aio_block &b, int id) {
+        const aio_job &job = *b.job;
+        bool fixed = job.slot >= 0;
+        memset(sqe, 0, sizeof(*sqe));
+        if (job.write)
+            sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        else
+            sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = job.fd;
+        sqe->off = job.offset + b.pos;
+        sqe->addr = (uint64_t)(job.buf + b.pos);
+        sqe->len = b.len;
+        sqe->buf_index = fixed ? job.slot : 0;
+        sqe->user_data = id;
+    }
+
+    // registers the buffer of the job in a free slot, if it can
+    void start_job(aio_job &job) {
+        if (job.slot != -2)
+            return;
+        job.slot = -1;
+        if (!fixed_ || job.size == 0 || job.size > (1u << 30))
+            return;
+
+        for (int i=0; i<AIO_SLOTS; i++) {
+            if (slots_[i])
+                continue;
+            if (update_slot(i, job.buf, job.size)) {
+                slots_[i] = true;
+                job.slot = i;
+            }
+            return;
+        }
+    }
+
+    void end_job(aio_job &job) {
+        if (job.slot < 0)
+            return;
+        update_slot(job.slot, NULL, 0);
+        slots_[job.slot] = false;
+        job.slot = -1;
+    }
+
+    bool update_slot(int slot, void *buf, size_t size) {
+        iovec iov = { buf, size };
+        io_uring_rsrc_update2 up;
+        memset(&up, 0, sizeof(up));
+        up.offset = slot;
+        up.data = (uint64_t)&iov;
+        up.nr = 1;
+        return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof(up)) == 1;
+    }
+
+private:
+    int fd_ = -1;
+    char *sq_ring_ = NULL;
+    char *cq_ring_ = NULL;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe *sqes_ = NULL;
+    unsigned *sq_tail_ = NULL;
+    unsigned sq_mask_ = 0;
+    unsigned *sq_array_ = NULL;
+    unsigned *cq_head_ = NULL;
+    unsigned *cq_tail_ = NULL;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe *cqes_ = NULL;
+    bool fixed_ = false;
+    bool slots_[AIO_SLOTS] = {false};
+    std::thread thread_;
+};
+
+// The engine of aio_backend(), made on first use; io_uring falls back to
+// threads when the kernel does not have it.
+static aio_engine &aio()
+{
+    static std::unique_ptr<aio_engine> engine;
+    static std::once_flag once;
+    std::call_once(once, []() {
+        if (aio_backend() != "threads") {
+            std::unique_ptr<uring_engine> uring(new uring_engine());
+            if (uring->open())
+                engine = std::move(uring);
+            else if (aio_backend() == "uring")
+                printf("io_uring unavailable (%s), using threads\n", strerror(errno));
+        }
+        if (!engine)
+            engine.reset(new thread_engine());
+    });
+    return *engine;
+}
+
+}
+
+#endif
@@ -7,79 +7,1270 @@
  * ===================================================
  */
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
 
 #include "file.h"
+#include "simd.h"
+#include "parallel.h"
+#include "value_format.h"
+#include "layout.h"
+#include "value_stats.h"
 #include "CLI11.hpp"
 
 using namespace kx;
 
-static inline void le_print(const char *p, int size) {
-    for (int i=size-1; i>=0; i--)
-        printf("%02x", p[i] & 0xff);
+// bytes printed per step of a streamed dump, rounded down to whole strides
+#define DUMP_CHUNK (1 << 20)
+
+// encoded chunks in flight per worker of a threaded dump
+#define DUMP_SLOTS_PER_THREAD 2
+
+// numbers located at once when --stats splits data and padding
+#define STATS_RUN 4096
+
+// bytes searched by one step of --find, a multiple of every number size
+#define FIND_CHUNK (8 << 20)
+
+// text parsed by one step of --undump, extended to the end of its line
+#define UNDUMP_CHUNK (4 << 20)
+
+// what dump writes: its rows, or one memory word per stride in the
+// memory init file formats of rtl simulators
+enum format_t {
+    FORMAT_DUMP,
+    FORMAT_READMEMH,    // verilog $readmemh
+    FORMAT_COE,         // xilinx coe
+    FORMAT_MIF,         // intel mif
+};
+
+static int format_type(const std::string &name)
+{
+    static const char *names[] = {"dump", "readmemh", "coe", "mif"};
+    for (int i=0; i<4; i++) {
+        if (name == names[i])
+            return i;
+    }
+    return -1;
 }
 
-static inline void be_print(const char *p, int size) {
-    for (int i=0; i<size; i++)
-        printf("%02x", p[i] & 0xff);
+static bool write_all(int fd, const char *p, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
 }
 
-static inline const char *next_number(int stride, int num_bytes, const char *p, int index) {
-    return p + index * num_bytes;
+// Output is built in a large buffer and handed to write(2) in few big
+// pieces; printf per byte used to be the whole cost of a dump. Without
+// an fd the buffer just grows, holding one chunk encoded by a worker.
+class out_buffer: private noncopyable {
+public:
+    out_buffer(int fd = STDOUT_FILENO, size_t size = 1 << 20): fd_(fd), buf_(size) {}
+    ~out_buffer() { flush(); }
+
+    // room for n chars at the returned pointer, see commit(); n must not
+    // exceed capacity() when writing to an fd
+    char *reserve(size_t n) {
+        if (pos_ + n > buf_.size()) {
+            if (fd_ >= 0)
+                flush();
+            else
+                buf_.resize(std::max(2 * buf_.size(), pos_ + n));
+        }
+        return &buf_[pos_];
+    }
+
+    void commit(char *end) { pos_ = end - &buf_[0]; }
+    size_t capacity() const { return buf_.size(); }
+
+    const char *data() const { return &buf_[0]; }
+    size_t size() const { return pos_; }
+    void clear() { pos_ = 0; }
+
+    // drops the last n chars, which must still be buffered
+    void unput(size_t n) { pos_ -= n; }
+
+    bool flush() {
+        bool ok = fd_ < 0 || write_all(fd_, &buf_[0], pos_);
+        if (fd_ >= 0)
+            pos_ = 0;
+        return ok;
+    }
+
+    // writes data after what is buffered
+    bool write(const char *data, size_t size) {
+        return flush() && write_all(fd_, data, size);
+    }
+
+    void append(const char *data, size_t size) {
+        while (size > 0) {
+            size_t n = std::min(size, buf_.size());
+            memcpy(reserve(n), data, n);
+            pos_ += n;
+            data += n;
+            size -= n;
+        }
+    }
+
+    void append(const std::string &s) { append(s.data(), s.size()); }
+
+private:
+    int fd_;
+    size_t pos_ = 0;
+    std::vector<char> buf_;
+};
+
+// the two hex digits of every byte value
+static const char *hex_pairs()
+{
+    struct table_t {
+        char v[512];
+        table_t() {
+            const char *digits = "0123456789abcdef";
+            for (int i=0; i<256; i++) {
+                v[2*i] = digits[i >> 4];
+                v[2*i + 1] = digits[i & 15];
+            }
+        }
+    };
+    static const table_t table;
+    return table.v;
 }
 
-static inline const char *next_number_r(int stride, int num_bytes, const char *p, int index) {
-    return p + (stride - 1 - index) * num_bytes;
+// size digits pairs of p, last byte first unless be
+static inline char *put_hex(char *out, const char *p, int size, bool be)
+{
+    const char *table = hex_pairs();
+    for (int i=0; i<size; i++) {
+        unsigned char c = p[be ? i : size - 1 - i];
+        memcpy(out + 2*i, table + 2*c, 2);
+    }
+    return out + 2*size;
 }
 
 class dumper {
 public:
-    dumper(int num_bytes, int stride, int reverse_stride = false, int reverse_number = false, int no_space = false):
+    dumper(int num_bytes, int stride, int reverse_stride = false, int reverse_number = false, int no_space = false,
+            int type = VALUE_HEX):
         num_bytes_(num_bytes), stride_(stride),
         reverse_stride_(reverse_stride),
         reverse_number_(reverse_number),
-        no_space_(no_space)
+        no_space_(no_space),
+        type_(type)
     {}
 
-    void dump(const void *data, int size) {
-        int strides = size / stride_size();
-        int remain = size % stride_size();
-        const char *p = (const char *)data;
+    // label every stride with the layout position of its numbers
+    void set_layout(const std::shared_ptr<layout_index> &index) { index_ = index; }
 
-        auto print = reverse_number_ ? be_print : le_print;
-        auto next_number_ptr = reverse_stride_ ? next_number_r : next_number;
+    // write the strides as memory words of a format_t instead of rows;
+    // needs no_space and hex numbers
+    void set_format(int format) { format_ = format; }
 
-        for (int i=0; i<strides; i++, p += stride_size()) {
-            for (int j=0; j<stride_; j++) {
-                print(next_number_ptr(stride_, num_bytes_, p, j), num_bytes_);
-                if (!no_space_)
-                    printf(" ");
+    // the rows dump prints for size bytes at file offset pos, into out
+    void print(out_buffer &out, const char *p, uint64_t size, uint64_t pos) { encode(out, p, size, pos); }
+
+    // Streams size bytes of file from offset a chunk at a time, dropping
+    // the pages of a chunk once it is printed so memory use stays flat
+    // however large the file is. With several threads the chunks are
+    // encoded by workers into DUMP_SLOTS_PER_THREAD buffers per thread
+    // and written in order, so the output is the same.
+    void dump(const mapped_file &file, uint64_t offset, uint64_t size) {
+        uint64_t chunk = std::max<uint64_t>(1, DUMP_CHUNK / stride_size()) * stride_size();
+        uint64_t chunks = (size + chunk - 1) / chunk;
+        const char *data = file.data() + offset;
+        size_t slots = worker_count() * DUMP_SLOTS_PER_THREAD;
+
+        words_offset_ = offset;
+        begin_words(size);
+
+        if (worker_count() <= 1) {
+            for (uint64_t i=0; i<chunks; i++) {
+                uint64_t n = std::min(chunk, size - i*chunk);
+                encode(out_, data + i*chunk, n, offset + i*chunk);
+                file.release(offset + i*chunk, n);
             }
-            printf("\n");
+            end_words(out_);
+            out_.flush();
+            return;
         }
 
-        for (size = remain; size > 0; p += num_bytes_, size -= num_bytes_) {
-            print(p, std::min(num_bytes_, size));
-            if (!no_space_)
-                printf(" ");
+        std::vector<std::shared_ptr<out_buffer> > bufs;
+        for (size_t i=0; i<slots; i++)
+            bufs.push_back(std::make_shared<out_buffer>(-1, 2*chunk + chunk/2));
+
+        parallel_ordered(STAGE_FORMAT, chunks, slots, [&](size_t i, size_t slot) {
+            bufs[slot]->clear();
+            encode(*bufs[slot], data + i*chunk, std::min(chunk, size - i*chunk), offset + i*chunk);
+        }, [&](size_t i, size_t slot) {
+            if (i == chunks - 1)
+                end_words(*bufs[slot]);
+            out_.write(bufs[slot]->data(), bufs[slot]->size());
+            file.release(offset + i*chunk, std::min(chunk, size - i*chunk));
+        });
+    }
+
+    // Prints only the strides where a and b differ, as
+    // "<stride>: <row of a> | <row of b>" with strides counted as dump
+    // prints them from offset, then a summary. Equal runs are
+    // skipped by mismatch() at memory speed and the pages are dropped as
+    // the scan passes, so it is one streaming pass however large the
+    // files are. Returns whether the compared ranges are equal.
+    bool diff(const mapped_file &a, const mapped_file &b, uint64_t offset, uint64_t size) {
+        const char *pa = a.data() + offset;
+        const char *pb = b.data() + offset;
+        uint64_t row = stride_size();
+        uint64_t strides = 0;
+        uint64_t numbers = 0;
+        uint64_t released = 0;
+        out_buffer text(-1);
+
+        for (uint64_t off=0; (off += mismatch(pa + off, pb + off, size - off)) < size; ) {
+            uint64_t index = off / row;
+            uint64_t begin = index * row;
+            uint64_t n = std::min(row, size - begin);
+
+            for (uint64_t i=0; i<n; i+=num_bytes_) {
+                int len = std::min<uint64_t>(num_bytes_, n - i);
+                numbers += memcmp(pa + begin + i, pb + begin + i, len) != 0;
+            }
+            strides++;
+
+            out_.append(string_format("%llu: ", (unsigned long long)index));
+            append_row(text, pa + begin, n, offset + begin);
+            out_.append(" | ");
+            append_row(text, pb + begin, n, offset + begin);
+            out_.append("\n");
+
+            off = begin + n;
+            if (off - released >= DUMP_CHUNK) {
+                a.release(offset + released, off - released);
+                b.release(offset + released, off - released);
+                released = off;
+            }
         }
 
-        if (remain)
-            printf("\n");
+        uint64_t total_numbers = (size + num_bytes_ - 1) / num_bytes_;
+        out_.append(string_format("%llu of %llu strides differ, %llu of %llu numbers differ\n",
+                    (unsigned long long)strides, (unsigned long long)((size + row - 1) / row),
+                    (unsigned long long)numbers, (unsigned long long)total_numbers));
+        out_.flush();
+        return strides == 0;
+    }
+
+    // Prints count, min, max, mean, zero fraction, nan/inf and a magnitude
+    // histogram of the numbers in one pass on the worker threads: for all
+    // numbers, for data and padding with --layout, or a line per stride
+    // column without histogram with columns.
+    void stats(const mapped_file &file, uint64_t offset, uint64_t size, bool columns) {
+        uint64_t chunk = std::max<uint64_t>(1, DUMP_CHUNK / stride_size()) * stride_size();
+        uint64_t chunks = (size + chunk - 1) / chunk;
+        size_t groups = columns ? stride_ : (index_ ? 2 : 1);
+        std::vector<value_stats> total(groups);
+        std::mutex mutex;
+
+        parallel_for(STAGE_COMPUTE, chunks, 1, [&](size_t begin, size_t end) {
+            std::vector<value_stats> part(groups);
+            std::vector<char> data(index_ ? STATS_RUN : 0);
+            for (size_t i=begin; i<end; i++) {
+                uint64_t n = std::min(chunk, size - i*chunk);
+                stats_chunk(part, file.data() + offset + i*chunk, (offset + i*chunk) / num_bytes_,
+                        n / num_bytes_, columns, (bool *)&data[0]);
+                file.release(offset + i*chunk, n);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t g=0; g<groups; g++)
+                total[g].merge(part[g]);
+        });
+
+        bool is_float = type_ == VALUE_F32 || type_ == VALUE_F16 || type_ == VALUE_BF16;
+        for (size_t g=0; g<groups; g++) {
+            std::string name = columns ? string_format("column %zu", g) :
+                (index_ ? (g ? "pad" : "data") : "all");
+            print_stats(name, total[g], is_float, !columns);
+        }
     }
 
-    void dump(const std::vector<char> &data) {
-        dump(&data[0], data.size());
+    // Prints every place where pat starts on a number of size bytes of
+    // file from offset, as "<number>: stride <s> column <c>" with numbers
+    // counted in the file, as -o takes them, and strides as dump prints
+    // them from offset; with --layout the position of the number in the
+    // layout follows. Chunks are searched on the worker threads and
+    // reported in order. Returns the number of matches.
+    uint64_t find(const mapped_file &file, uint64_t offset, uint64_t size, const std::string &pat) {
+        uint64_t starts = size >= pat.size() ? size - pat.size() + 1 : 0;
+        uint64_t chunks = (starts + FIND_CHUNK - 1) / FIND_CHUNK;
+        const char *data = file.data() + offset;
+        size_t slots = worker_count() * DUMP_SLOTS_PER_THREAD;
+        std::vector<std::vector<uint64_t> > found(std::max<size_t>(1, slots));
+        std::vector<char> run(pat.size() / num_bytes_ + 1);
+        std::string text;
+        uint64_t matches = 0;
+
+        parallel_ordered(STAGE_COMPARE, chunks, slots, [&](size_t i, size_t slot) {
+            uint64_t begin = i * FIND_CHUNK;
+            std::vector<uint64_t> &v = found[slot];
+            v.clear();
+            search(data + begin, std::min<uint64_t>(FIND_CHUNK, starts - begin), pat.data(), pat.size(),
+                    num_bytes_, [&](size_t pos) { v.push_back(begin + pos); });
+        }, [&](size_t i, size_t slot) {
+            for (uint64_t pos: found[slot]) {
+                out_.append(string_format("%llu: stride %llu column %llu",
+                            (unsigned long long)((offset + pos) / num_bytes_),
+                            (unsigned long long)(pos / stride_size()),
+                            (unsigned long long)(pos % stride_size() / num_bytes_)));
+                if (index_) {
+                    label(text, (offset + pos) / num_bytes_, pat.size() / num_bytes_, (bool *)&run[0]);
+                    out_.append(text);
+                } else {
+                    out_.append("\n");
+                }
+            }
+            matches += found[slot].size();
+            file.release(offset + i*FIND_CHUNK, std::min<uint64_t>(FIND_CHUNK, size - i*FIND_CHUNK));
+        });
+
+        out_.append(string_format("%llu matches\n", (unsigned long long)matches));
+        out_.flush();
+        return matches;
+    }
+
+    // Writes size bytes of file from offset to out the way dump shows
+    // them with --be and -r: numbers byte swapped and strides in reverse
+    // order, so a plain dump of the result prints the same rows. A
+    // partial stride at the end keeps its order and a partial number is
+    // copied. Chunks are converted on the worker threads and written in
+    // order.
+    bool convert(const mapped_file &file, uint64_t offset, uint64_t size, kx::file &out) {
+        uint64_t chunk = std::max<uint64_t>(1, DUMP_CHUNK / stride_size()) * stride_size();
+        uint64_t chunks = (size + chunk - 1) / chunk;
+        const char *data = file.data() + offset;
+        size_t slots = worker_count() * DUMP_SLOTS_PER_THREAD;
+        std::vector<std::vector<char> > bufs(std::max<size_t>(1, slots), std::vector<char>(chunk));
+        bool ok = true;
+
+        parallel_ordered(STAGE_FORMAT, chunks, slots, [&](size_t i, size_t slot) {
+            uint64_t n = std::min(chunk, size - i*chunk);
+            uint64_t strides = n / stride_size() * stride_size();
+            uint64_t numbers = n / num_bytes_ * num_bytes_;
+            const char *src = data + i*chunk;
+            char *dst = &bufs[slot][0];
+
+            convert_strides(dst, src, strides, stride_size(), num_bytes_, reverse_number_, reverse_stride_);
+            convert_strides(dst + strides, src + strides, numbers - strides, num_bytes_, num_bytes_,
+                    reverse_number_, false);
+            memcpy(dst + numbers, src + numbers, n - numbers);
+        }, [&](size_t i, size_t slot) {
+            uint64_t n = std::min(chunk, size - i*chunk);
+            ok = ok && out.write(&bufs[slot][0], n) == n;
+            file.release(offset + i*chunk, n);
+        });
+
+        return ok;
+    }
+
+    // Reads text printed by dump with the same -b, -s, --be, -r and
+    // --nospace back into the numbers and writes them to out. Rows in the
+    // exact form dump prints them, labels allowed, are decoded 16 digits
+    // at a time; hand edited rows go through undump_tokens(). The text is
+    // cut at line ends into chunks parsed on the worker threads and
+    // written in order. Prints the line of the first bad row or the write
+    // error.
+    bool undump(const mapped_file &text, kx::file &out) {
+        const char *data = text.data();
+        uint64_t size = text.size();
+        uint64_t chunks = (size + UNDUMP_CHUNK - 1) / UNDUMP_CHUNK;
+        size_t slots = std::max<size_t>(1, worker_count() * DUMP_SLOTS_PER_THREAD);
+        std::vector<std::vector<char> > bufs(slots);
+        std::vector<uint64_t> lines(slots);
+        std::vector<int64_t> bad(slots);
+        uint64_t line = 0;
+        bool ok = true;
+
+        // the first line starting at or after pos
+        auto line_start = [&](uint64_t pos) -> uint64_t {
+            if (pos == 0 || pos >= size)
+                return std::min(pos, size);
+            const char *nl = (const char *)memchr(data + pos - 1, '\n', size - pos + 1);
+            return nl ? nl - data + 1 : size;
+        };
+
+        parallel_ordered(STAGE_FORMAT, chunks, slots, [&](size_t i, size_t slot) {
+            uint64_t begin = line_start(i * UNDUMP_CHUNK);
+            uint64_t end = line_start((i + 1) * UNDUMP_CHUNK);
+            bufs[slot].clear();
+            bufs[slot].reserve((end - begin) / 2);
+            lines[slot] = 0;
+            bad[slot] = -1;
+
+            for (uint64_t pos=begin; pos<end; lines[slot]++) {
+                const char *p = data + pos;
+                const char *nl = (const char *)memchr(p, '\n', end - pos);
+                const char *e = nl ? nl : data + end;
+                pos = e - data + 1;
+
+                if (!undump_line(p, e, bufs[slot])) {
+                    bad[slot] = lines[slot];
+                    break;
+                }
+            }
+        }, [&](size_t i, size_t slot) {
+            if (ok && bad[slot] >= 0) {
+                printf("bad hex at line %llu\n", (unsigned long long)(line + bad[slot] + 1));
+                ok = false;
+            }
+            if (ok && out.write(bufs[slot].data(), bufs[slot].size()) != bufs[slot].size()) {
+                printf("can not write the numbers: %s\n", strerror(errno));
+                ok = false;
+            }
+            line += lines[slot];
+            // the end of the last chunk too, read again to find the
+            // start of this one
+            text.release(i ? (i - 1) * UNDUMP_CHUNK : 0, 2 * UNDUMP_CHUNK);
+        });
+
+        return ok;
     }
 
 private:
     int stride_size() { return stride_ * num_bytes_; }
 
+    bool undump_line(const char *p, const char *end, std::vector<char> &out) {
+        const int period = 2*num_bytes_ + !no_space_;
+        const char *numbers_end = p + (size_t)stride_ * period;
+        const char *q = numbers_end;
+
+        if (numbers_end <= end) {
+            while (q < end && *q == ' ')
+                q++;
+        }
+        if (numbers_end > end || (q < end && *q != '#'))
+            return undump_tokens(p, end, out);
+
+        size_t old = out.size();
+        out.resize(old + stride_size());
+        bool ok = false;
+        switch (num_bytes_) {
+        case 1: ok = undump_row<1>(p, &out[old]); break;
+        case 2: ok = undump_row<2>(p, &out[old]); break;
+        case 4: ok = undump_row<4>(p, &out[old]); break;
+        case 8: ok = undump_row<8>(p, &out[old]); break;
+        }
+        if (ok)
+            return true;
+
+        out.resize(old);
+        return undump_tokens(p, end, out);
+    }
+
+    // A row as dump prints it: stride numbers of 2N digits, each followed
+    // by a space unless --nospace. The digits of 8/N numbers are gathered
+    // in file order (right to left for -r) and decoded at once.
+    template<int N>
+    bool undump_row(const char *line, char *out) {
+#ifdef __SSE2__
+        const int period = 2*N + !no_space_;
+        const int block = 8 / N;
+        char digits[16];
+        char bytes[16];
+
+        for (int j=0; j<stride_; j+=block) {
+            int k = std::min(block, stride_ - j);
+            for (int t=0; t<k; t++) {
+                const char *number = line + (reverse_stride_ ? stride_ - 1 - j - t : j + t) * period;
+                if (!no_space_ && number[2*N] != ' ')
+                    return false;
+                memcpy(digits + 2*N*t, number, 2*N);
+            }
+
+            int bad;
+            __m128i v = hex_decode(_mm_loadu_si128((const __m128i *)digits), &bad);
+            if (bad & ((1 << (2*N*k)) - 1))
+                return false;
+            if (!reverse_number_)
+                v = reverse_lanes(v, N);
+            _mm_storeu_si128((__m128i *)bytes, v);
+            memcpy(out + j*N, bytes, k*N);
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Any other row: numbers separated by blanks, or runs of them with
+    // --nospace, up to a '#' label. A number of fewer digits is a partial
+    // number like the one dump prints last. Only a row of stride whole
+    // numbers is put back in order for -r, as only those are reversed.
+    bool undump_tokens(const char *p, const char *end, std::vector<char> &out) {
+        size_t start = out.size();
+        size_t digits = 2 * num_bytes_;
+        int numbers = 0;
+        bool partial = false;
+
+        while (p < end && *p != '#') {
+            if (*p == ' ' || *p == '\t' || *p == '\r') {
+                p++;
+                continue;
+            }
+
+            const char *q = p;
+            while (q < end && isxdigit((unsigned char)*q))
+                q++;
+            if (q == p || (q < end && !strchr(" \t\r#", *q)) || (!no_space_ && q - p > (ptrdiff_t)digits))
+                return false;
+
+            for (; p < q; p += digits) {
+                size_t n = std::min<size_t>(digits, q - p);
+                if (n % 2)
+                    return false;
+
+                size_t base = out.size();
+                out.resize(base + n/2);
+                for (size_t b=0; b<n/2; b++)
+                    out[base + (reverse_number_ ? b : n/2 - 1 - b)] = hex_value(p[2*b]) << 4 | hex_value(p[2*b + 1]);
+                if (n == digits)
+                    numbers++;
+                else
+                    partial = true;
+            }
+            p = q;
+        }
+
+        if (reverse_stride_ && numbers == stride_ && !partial) {
+            std::vector<char> row(out.begin() + start, out.end());
+            for (int j=0; j<stride_; j++)
+                memcpy(&out[start + j*num_bytes_], &row[(stride_ - 1 - j) * num_bytes_], num_bytes_);
+        }
+        return true;
+    }
+
+    static int hex_value(char c) { return (c & 0xf) + 9 * (c >> 6); }
+
+    void stats_chunk(std::vector<value_stats> &groups, const char *p, uint64_t addr, uint64_t n,
+            bool columns, bool *data) {
+        int type = type_ == VALUE_HEX ? -num_bytes_ : type_;
+        switch (type) {
+        case VALUE_F32:  stats_numbers<VALUE_F32, 4>(groups, p, addr, n, columns, data); break;
+        case VALUE_F16:  stats_numbers<VALUE_F16, 2>(groups, p, addr, n, columns, data); break;
+        case VALUE_BF16: stats_numbers<VALUE_BF16, 2>(groups, p, addr, n, columns, data); break;
+        case VALUE_I8:   stats_numbers<VALUE_I8, 1>(groups, p, addr, n, columns, data); break;
+        case VALUE_I16:  stats_numbers<VALUE_I16, 2>(groups, p, addr, n, columns, data); break;
+        case VALUE_I32:  stats_numbers<VALUE_I32, 4>(groups, p, addr, n, columns, data); break;
+        case VALUE_U32:  stats_numbers<VALUE_U32, 4>(groups, p, addr, n, columns, data); break;
+        case -1:         stats_numbers<VALUE_HEX, 1>(groups, p, addr, n, columns, data); break;
+        case -2:         stats_numbers<VALUE_HEX, 2>(groups, p, addr, n, columns, data); break;
+        case -4:         stats_numbers<VALUE_HEX, 4>(groups, p, addr, n, columns, data); break;
+        case -8:         stats_numbers<VALUE_HEX, 8>(groups, p, addr, n, columns, data); break;
+        }
+    }
+
+    // addr is the number index of p in the file, chunks start on a stride
+    template<int TYPE, int N>
+    void stats_numbers(std::vector<value_stats> &groups, const char *p, uint64_t addr, uint64_t n,
+            bool columns, bool *data) {
+        if (columns) {
+            for (uint64_t i=0; i<n; i++)
+                groups[i % stride_].add_raw<TYPE, N>(load_number<N>(p + i*N, reverse_number_));
+            return;
+        }
+        if (!index_) {
+            groups[0].add_numbers<TYPE, N>(p, n, reverse_number_);
+            return;
+        }
+
+        // runs of data or padding go to their group whole
+        int first[LAYOUT_COORDS];
+        bool first_data;
+        for (uint64_t done=0; done<n; done+=STATS_RUN) {
+            int m = std::min<uint64_t>(STATS_RUN, n - done);
+            locate_numbers(addr + done, m, data, first, &first_data);
+            for (int i=0; i<m; ) {
+                int j = i + 1;
+                while (j < m && data[j] == data[i])
+                    j++;
+                groups[data[i] ? 0 : 1].add_numbers<TYPE, N>(p + (done + i)*N, j - i, reverse_number_);
+                i = j;
+            }
+        }
+    }
+
+    static void print_stats(const std::string &name, const value_stats &s, bool is_float, bool hist) {
+        printf("%s: %llu numbers", name.c_str(), (unsigned long long)s.count);
+        if (!s.count) {
+            printf("\n");
+            return;
+        }
+
+        uint64_t finite = s.count - s.nans - s.infs;
+        const char *fmt = is_float ? ", min %.9g, max %.9g" : ", min %.0f, max %.0f";
+        if (finite)
+            printf(fmt, s.min, s.max);
+        printf(", mean %.9g, zero %.3f%%", finite ? s.sum / finite : 0, 100.0 * s.zeros / s.count);
+        if (is_float)
+            printf(", nan %llu, inf %llu", (unsigned long long)s.nans, (unsigned long long)s.infs);
+        printf("\n");
+
+        for (int i=0; hist && i<STATS_BINS; i++) {
+            if (s.hist[i])
+                printf("  %-20s %14llu %8.3f%%\n", stats_bin_name(i, is_float).c_str(),
+                        (unsigned long long)s.hist[i], 100.0 * s.hist[i] / s.count);
+        }
+    }
+
+    // one row as printed by dump, without the newline
+    void append_row(out_buffer &text, const char *p, uint64_t size, uint64_t pos) {
+        text.clear();
+        encode(text, p, size, pos);
+        out_.append(text.data(), text.size() - 1);
+    }
+
+    // pos is the file offset of p
+    void encode(out_buffer &out, const char *p, uint64_t size, uint64_t pos) {
+        if (format_ != FORMAT_DUMP) {
+            encode_words(out, p, size, pos);
+            return;
+        }
+        if (!index_) {
+            encode_rows(out, p, size);
+            return;
+        }
+
+        // one row at a time, each followed by its layout label
+        std::vector<char> data(stride_);
+        std::string text;
+        for (uint64_t done=0; done<size; done+=stride_size()) {
+            uint64_t n = std::min<uint64_t>(stride_size(), size - done);
+            encode_rows(out, p + done, n);
+            out.unput(1);
+            label(text, (pos + done) / num_bytes_, (n + num_bytes_ - 1) / num_bytes_, (bool *)&data[0]);
+            out.append(text);
+        }
+    }
+
+    // The header of a memory init file of size bytes; a word is a stride.
+    void begin_words(uint64_t size) {
+        uint64_t words = (size + stride_size() - 1) / stride_size();
+        if (format_ == FORMAT_COE)
+            out_.append("memory_initialization_radix=16;\nmemory_initialization_vector=\n");
+        if (format_ == FORMAT_MIF)
+            out_.append(string_format("DEPTH = %llu;\nWIDTH = %d;\nADDRESS_RADIX = HEX;\n"
+                        "DATA_RADIX = HEX;\nCONTENT\nBEGIN\n", (unsigned long long)words, stride_size() * 8));
+    }
+
+    // out holds the last word
+    void end_words(out_buffer &out) {
+        if (format_ == FORMAT_COE) {
+            out.unput(2);
+            out.append(";\n");
+        }
+        if (format_ == FORMAT_MIF)
+            out.append("END;\n");
+    }
+
+    // One word per stride, its numbers printed as by --nospace; a partial
+    // stride at the end is padded with zeros to a whole word. Words are
+    // numbered from the offset of the dump.
+    void encode_words(out_buffer &out, const char *p, uint64_t size, uint64_t pos) {
+        std::vector<char> last;
+        for (uint64_t done=0; done<size; done+=stride_size()) {
+            const char *row = p + done;
+            if (size - done < (uint64_t)stride_size()) {
+                last.assign(stride_size(), 0);
+                memcpy(&last[0], row, size - done);
+                row = &last[0];
+            }
+
+            if (format_ == FORMAT_MIF) {
+                uint64_t addr = (pos + done - words_offset_) / stride_size();
+                char *o = out.reserve(20);
+                char digits[16];
+                int n = 0;
+                do {
+                    digits[n++] = "0123456789abcdef"[addr & 15];
+                    addr >>= 4;
+                } while (addr);
+                while (n)
+                    *o++ = digits[--n];
+                memcpy(o, " : ", 3);
+                out.commit(o + 3);
+            }
+
+            encode_rows(out, row, stride_size());
+            out.unput(1);
+            switch (format_) {
+            case FORMAT_READMEMH: out.append("\n"); break;
+            case FORMAT_COE:      out.append(",\n"); break;
+            case FORMAT_MIF:      out.append(";\n"); break;
+            }
+        }
+    }
+
+    // locate_run() for n numbers from number addr. Layout addresses count
+    // 32 bit words: a smaller number is data if its word is, a larger one
+    // if any of its words is.
+    bool locate_numbers(uint64_t addr, int n, bool *data, int *first, bool *first_data) {
+        if (num_bytes_ == LAYOUT_WORD)
+            return index_->locate_run(addr, n, data, first, first_data);
+
+        uint64_t begin = addr * num_bytes_;
+        uint64_t word = begin / LAYOUT_WORD;
+        int words = (begin + (uint64_t)n * num_bytes_ + LAYOUT_WORD - 1) / LAYOUT_WORD - word;
+        std::vector<char> word_data(std::max(words, 1));
+        bool found = index_->locate_run(word, words, (bool *)&word_data[0], first, first_data);
+
+        for (int i=0; i<n; i++) {
+            uint64_t b = begin + (uint64_t)i * num_bytes_ - word * LAYOUT_WORD;
+            data[i] = false;
+            for (uint64_t w=b/LAYOUT_WORD; w<=(b + num_bytes_ - 1)/LAYOUT_WORD; w++)
+                data[i] = data[i] || word_data[w];
+        }
+        return found;
+    }
+
+    // "  # <first located number of the row>, pad <columns>\n", columns
+    // counted in file order; addr counts numbers of the blob. Same text
+    // as layout::describe, built without printf.
+    void label(std::string &s, uint64_t addr, int count, bool *data) {
+        int first[LAYOUT_COORDS];
+        bool first_data = false;
+        char num[VALUE_CHARS];
+
+        s.assign("  # ");
+        if (!locate_numbers(addr, count, data, first, &first_data)) {
+            s += "pad\n";
+            return;
+        }
+
+        const char *const *names = index_->get()->coord_names();
+        for (int i=0; names[i]; i++) {
+            if (i)
+                s += ' ';
+            s += names[i];
+            s += ' ';
+            s.append(num, put_i32(num, first[i]) - num);
+        }
+        if (!first_data)
+            s += " pad";
+
+        const char *sep = ", pad ";
+        for (int i=0; i<count; ) {
+            if (data[i]) {
+                i++;
+                continue;
+            }
+
+            int j = i + 1;
+            while (j < count && !data[j])
+                j++;
+            s += sep;
+            sep = ",";
+            s.append(num, put_u32(num, i) - num);
+            if (j - i > 1) {
+                s += '-';
+                s.append(num, put_u32(num, j - 1) - num);
+            }
+            i = j;
+        }
+        s += '\n';
+    }
+
+    void encode_rows(out_buffer &out, const char *p, uint64_t size) {
+        uint64_t strides = size / stride_size();
+        int remain = size % stride_size();
+
+        switch (type_) {
+        case VALUE_F32:  dump_values<VALUE_F32, 4>(out, p, strides); break;
+        case VALUE_F16:  dump_values<VALUE_F16, 2>(out, p, strides); break;
+        case VALUE_BF16: dump_values<VALUE_BF16, 2>(out, p, strides); break;
+        case VALUE_I8:   dump_values<VALUE_I8, 1>(out, p, strides); break;
+        case VALUE_I16:  dump_values<VALUE_I16, 2>(out, p, strides); break;
+        case VALUE_I32:  dump_values<VALUE_I32, 4>(out, p, strides); break;
+        case VALUE_U32:  dump_values<VALUE_U32, 4>(out, p, strides); break;
+        }
+
+        // constant number sizes let the compiler unroll put_hex
+        switch (type_ == VALUE_HEX ? num_bytes_ * 2 + reverse_number_ : 0) {
+        case 2:  dump_strides<1, false>(out, p, strides); break;
+        case 3:  dump_strides<1, true>(out, p, strides); break;
+        case 4:  dump_strides<2, false>(out, p, strides); break;
+        case 5:  dump_strides<2, true>(out, p, strides); break;
+        case 8:  dump_strides<4, false>(out, p, strides); break;
+        case 9:  dump_strides<4, true>(out, p, strides); break;
+        case 16: dump_strides<8, false>(out, p, strides); break;
+        case 17: dump_strides<8, true>(out, p, strides); break;
+        }
+        p += (size_t)strides * stride_size();
+
+        // a partial number at the end is shown in hex
+        for (int n = remain; n > 0; p += num_bytes_, n -= num_bytes_) {
+            char *o = out.reserve(std::max(2*num_bytes_, VALUE_CHARS) + 1);
+            if (type_ != VALUE_HEX && n >= num_bytes_)
+                o = put_typed(o, p);
+            else
+                o = put_hex(o, p, std::min(num_bytes_, n), reverse_number_);
+            if (!no_space_ || type_ != VALUE_HEX)
+                *o++ = ' ';
+            out.commit(o);
+        }
+
+        if (remain) {
+            char *o = out.reserve(1);
+            *o++ = '\n';
+            out.commit(o);
+        }
+    }
+
+    // Rows are encoded 16 bytes at a time: the block is put in display
+    // order (numbers reversed for -r, bytes reversed unless --be) and
+    // turned into 32 hex digits at once.
+    template<int N, bool BE>
+    void dump_strides(out_buffer &out, const char *p, uint64_t strides) {
+        const size_t number = 2*N + 1;
+        size_t row_bytes = (size_t)stride_ * N;
+        size_t reserve = std::min(stride_ * number + 1, out.capacity());
+        bool rs = reverse_stride_;
+
+        for (uint64_t i=0; i<strides; i++, p += row_bytes) {
+            char *o = out.reserve(reserve);
+            char *end = o + reserve;
+            size_t done = 0;
+#ifdef __SSE2__
+            for (; done + 16 <= row_bytes; done += 16) {
+                if (o + 16/N*number > end) {
+                    out.commit(o);
+                    o = out.reserve(reserve);
+                    end = o + reserve;
+                }
+                const char *q = rs ? p + row_bytes - done - 16 : p + done;
+                __m128i v = _mm_loadu_si128((const __m128i *)q);
+                if (!BE != rs)
+                    v = reverse_lanes(v, N);
+                if (rs)
+                    v = reverse_lanes(v, 16);
+                o = put_block<N>(o, v);
+            }
+#endif
+            const char *q = rs ? p + row_bytes - done - N : p + done;
+            for (; done < row_bytes; done += N, q += rs ? -N : N) {
+                if (o + number > end) {
+                    out.commit(o);
+                    o = out.reserve(reserve);
+                    end = o + reserve;
+                }
+                o = put_hex(o, q, N, BE);
+                if (!no_space_)
+                    *o++ = ' ';
+            }
+
+            if (o == end) {
+                out.commit(o);
+                o = out.reserve(1);
+            }
+            *o++ = '\n';
+            out.commit(o);
+        }
+    }
+
+    template<int N>
+    uint32_t load(const char *p) { return load_number<N>(p, reverse_number_); }
+
+    char *put_typed(char *o, const char *p) {
+        switch (type_) {
+        case VALUE_F32:  return put_value<VALUE_F32>(o, load<4>(p));
+        case VALUE_F16:  return put_value<VALUE_F16>(o, load<2>(p));
+        case VALUE_BF16: return put_value<VALUE_BF16>(o, load<2>(p));
+        case VALUE_I8:   return put_value<VALUE_I8>(o, load<1>(p));
+        case VALUE_I16:  return put_value<VALUE_I16>(o, load<2>(p));
+        case VALUE_I32:  return put_value<VALUE_I32>(o, load<4>(p));
+        case VALUE_U32:  return put_value<VALUE_U32>(o, load<4>(p));
+        }
+        return o;
+    }
+
+    // Decoded values are always separated by a space, --nospace only
+    // applies to hex. --be reads big endian values.
+    template<int TYPE, int N>
+    void dump_values(out_buffer &out, const char *p, uint64_t strides) {
+        const size_t number = VALUE_CHARS + 1;
+        size_t row_bytes = (size_t)stride_ * N;
+        size_t reserve = std::min(stride_ * number + 1, out.capacity());
+        int step = reverse_stride_ ? -N : N;
+
+        for (uint64_t i=0; i<strides; i++, p += row_bytes) {
+            const char *q = reverse_stride_ ? p + row_bytes - N : p;
+            char *o = out.reserve(reserve);
+            char *end = o + reserve;
+
+            for (int j=0; j<stride_; j++, q += step) {
+                if (o + number > end) {
+                    out.commit(o);
+                    o = out.reserve(reserve);
+                    end = o + reserve;
+                }
+                o = put_value<TYPE>(o, load<N>(q));
+                *o++ = ' ';
+            }
+
+            if (o == end) {
+                out.commit(o);
+                o = out.reserve(1);
+            }
+            *o++ = '\n';
+            out.commit(o);
+        }
+    }
+
+#ifdef __SSE2__
+    template<int N>
+    char *put_block(char *o, __m128i v) {
+        if (no_space_) {
+            hex_encode(v, o);
+            return o + 32;
+        }
+
+        char hex[32];
+        hex_encode(v, hex);
+        for (int k=0; k<16/N; k++, o += 2*N + 1) {
+            memcpy(o, hex + 2*N*k, 2*N);
+            o[2*N] = ' ';
+        }
+        return o;
+    }
+#endif
+
 private:
     int num_bytes_;
     int stride_;
     bool reverse_stride_;
     bool reverse_number_;
     bool no_space_;
+    int type_;
+    int format_ = FORMAT_DUMP;
+    uint64_t words_offset_ = 0;
+    std::shared_ptr<layout_index> index_;
+    out_buffer out_;
+};
+
+// The bytes of the hex numbers in text, separated by spaces or commas,
+// each stored in bytes bytes in file order. A token longer than one
+// number is read as numbers printed by --nospace, left to right.
+static bool parse_pattern(const std::string &text, int bytes, bool be, std::string *pat)
+{
+    pat->clear();
+    for (size_t i=0; i<text.size(); ) {
+        if (text[i] == ' ' || text[i] == ',') {
+            i++;
+            continue;
+        }
+
+        size_t end = text.find_first_of(" ,", i);
+        std::string token = text.substr(i, end == std::string::npos ? std::string::npos : end - i);
+        i += token.size();
+        if (token.size() > 2 && token[0] == '0' && (token[1] == 'x' || token[1] == 'X'))
+            token = token.substr(2);
+        if (token.empty() || token.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+            return false;
+
+        size_t digits = 2 * bytes;
+        if (token.size() > digits && token.size() % digits)
+            return false;
+        if (token.size() < digits)
+            token.insert(0, digits - token.size(), '0');
+
+        for (size_t j=0; j<token.size(); j+=digits) {
+            uint64_t v = strtoull(token.substr(j, digits).c_str(), NULL, 16);
+            for (int k=0; k<bytes; k++)
+                *pat += (char)(v >> 8 * (be ? bytes - 1 - k : k));
+        }
+    }
+    return !pat->empty();
+}
+
+// Full screen view of a mapped file in the terminal. Only the rows on
+// the screen are encoded, so paging and seeking cost the same however
+// large the file is. Rows are strides counted from base, the -o offset
+// modulo a stride.
+class viewer: private noncopyable {
+public:
+    viewer(dumper &d, const mapped_file &file, uint64_t begin, int num_bytes, int row_bytes, bool be,
+            const std::shared_ptr<layout_index> &index):
+        dumper_(d), file_(file), num_bytes_(num_bytes), row_(row_bytes), be_(be), index_(index),
+        text_(-1)
+    {
+        base_ = begin % row_;
+        top_ = (begin - base_) / row_;
+        rows_ = (file.size() - base_ + row_ - 1) / row_;
+    }
+
+    // false when stdin or stdout is not a terminal
+    bool run() {
+        if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO))
+            return false;
+
+        struct termios old, raw;
+        tcgetattr(STDIN_FILENO, &old);
+        raw = old;
+        raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+        raw.c_iflag &= ~(IXON | ICRNL);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+        put("\x1b[?1049h\x1b[?25l");
+
+        do {
+            draw();
+        } while (key());
+
+        put("\x1b[?25h\x1b[?1049l");
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &old);
+        return true;
+    }
+
+private:
+    static void put(const std::string &s) { write_all(STDOUT_FILENO, s.data(), s.size()); }
+
+    void screen(int *rows, int *cols) {
+        struct winsize ws;
+        *rows = 24;
+        *cols = 80;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 1 && ws.ws_col > 0) {
+            *rows = ws.ws_row;
+            *cols = ws.ws_col;
+        }
+        (*rows)--;      // the status line
+    }
+
+    void draw() {
+        int rows, cols;
+        screen(&rows, &cols);
+
+        uint64_t first = base_ + top_ * row_;
+        text_.clear();
+        dumper_.print(text_, file_.data() + first, std::min<uint64_t>((uint64_t)rows * row_, file_.size() - first), first);
+
+        int digits = string_format("%llu", (unsigned long long)(file_.size() / num_bytes_)).size();
+        const char *p = text_.data();
+        const char *end = p + text_.size();
+        std::string out = "\x1b[H";
+        for (int i=0; i<rows; i++) {
+            if (p < end) {
+                const char *nl = (const char *)memchr(p, '\n', end - p);
+                std::string line = string_format("%*llu: ", digits,
+                        (unsigned long long)((first + (uint64_t)i * row_) / num_bytes_));
+                if (left_ < (size_t)(nl - p))
+                    line.append(p + left_, nl - p - left_);
+                out += line.substr(0, cols);
+                p = nl + 1;
+            } else {
+                out += "~";
+            }
+            out += "\x1b[K\r\n";
+        }
+
+        std::string status = string_format(" element %llu of %llu, stride %llu of %llu",
+                (unsigned long long)(first / num_bytes_), (unsigned long long)(file_.size() / num_bytes_),
+                (unsigned long long)top_, (unsigned long long)rows_);
+        if (index_) {
+            int coord[LAYOUT_COORDS];
+            bool data = index_->locate(first / LAYOUT_WORD, coord);
+            status += ", " + index_->get()->describe(coord, data);
+        }
+        status += "  " + (status_.empty() ? "q j k space b g G h l :goto /find n" : status_);
+        out += "\x1b[7m" + status.substr(0, cols) + "\x1b[K\x1b[0m";
+        put(out);
+    }
+
+    // reads and handles one key, false to quit
+    bool key() {
+        char buf[16];
+        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            return true;
+        if (n <= 0)
+            return false;
+
+        int rows, cols;
+        screen(&rows, &cols);
+        int64_t page = std::max(1, rows - 1);
+        std::string k(buf, n);
+        status_.clear();
+
+        if (k == "q" || k == "\x03")
+            return false;
+        if (k == "j" || k == "\r" || k == "\x1b[B")
+            scroll(1);
+        else if (k == "k" || k == "\x1b[A")
+            scroll(-1);
+        else if (k == " " || k == "f" || k == "\x1b[6~")
+            scroll(page);
+        else if (k == "b" || k == "\x1b[5~")
+            scroll(-page);
+        else if (k == "g" || k == "\x1b[H" || k == "\x1b[1~")
+            top_ = 0;
+        else if (k == "G" || k == "\x1b[F" || k == "\x1b[4~")
+            top_ = rows_ > (uint64_t)rows ? rows_ - rows : 0;
+        else if (k == "l" || k == "\x1b[C")
+            left_ += 8;
+        else if (k == "h" || k == "\x1b[D")
+            left_ = left_ > 8 ? left_ - 8 : 0;
+        else if (k == ":")
+            go(prompt(":"));
+        else if (k == "/")
+            find_text(prompt("/"));
+        else if (k == "n")
+            find_next();
+        return true;
+    }
+
+    void scroll(int64_t rows) {
+        if (rows < 0)
+            top_ = top_ > (uint64_t)-rows ? top_ + rows : 0;
+        else
+            top_ = std::min(top_ + rows, rows_ - 1);
+    }
+
+    // a line typed on the status line, empty if cancelled with escape
+    std::string prompt(const char *p) {
+        int rows, cols;
+        screen(&rows, &cols);
+        std::string line;
+        put("\x1b[?25h");
+        for (;;) {
+            put(string_format("\x1b[%d;1H\x1b[K%s%s", rows + 1, p, line.c_str()));
+            char c;
+            if (read(STDIN_FILENO, &c, 1) != 1 || c == '\x1b' || c == '\x03') {
+                line.clear();
+                break;
+            }
+            if (c == '\r' || c == '\n')
+                break;
+            if ((c == 0x7f || c == '\b') && !line.empty())
+                line.erase(line.size() - 1);
+            else if (c >= ' ' && c < 0x7f)
+                line += c;
+        }
+        put("\x1b[?25l");
+        return line;
+    }
+
+    // "<element>", "o <element>", "b <byte offset>", "s <stride>" or
+    // "c <coordinates>" of --layout; numbers may be hex with 0x
+    void go(const std::string &cmd) {
+        if (cmd.empty())
+            return;
+
+        bool plain = isdigit((unsigned char)cmd[0]);
+        char kind = plain ? 'o' : cmd[0];
+        const char *arg = cmd.c_str() + !plain;
+        char *end;
+        uint64_t v = strtoull(arg, &end, 0);
+
+        if (kind == 'c') {
+            int coord[LAYOUT_COORDS] = {0};
+            int n = 0;
+            for (char *q = (char *)arg; n < LAYOUT_COORDS; n++) {
+                coord[n] = strtol(q, &end, 0);
+                if (end == q)
+                    break;
+                q = end;
+            }
+
+            size_t addr;
+            if (!index_)
+                status_ = "no --layout";
+            else if (n == 0 || !index_->find(coord, &addr))
+                status_ = "no such coordinate";
+            else
+                show(addr * LAYOUT_WORD);
+            return;
+        }
+
+        if (end == arg || !strchr("obs", kind)) {
+            status_ = "goto: [o] element, b byte offset, s stride, c coordinates";
+            return;
+        }
+        if (kind == 's') {
+            top_ = std::min(v, rows_ - 1);
+            return;
+        }
+        show(kind == 'o' ? v * num_bytes_ : v);
+    }
+
+    // puts the row of byte pos at the top
+    void show(uint64_t pos) {
+        if (pos >= file_.size()) {
+            status_ = "past the end";
+            return;
+        }
+        top_ = pos < base_ ? 0 : (pos - base_) / row_;
+    }
+
+    void find_text(const std::string &text) {
+        if (text.empty())
+            return;
+        if (!parse_pattern(text, num_bytes_, be_, &pattern_)) {
+            status_ = "invalid pattern";
+            return;
+        }
+        find(base_ + top_ * row_);
+    }
+
+    // after the last match if it is still on the top row
+    void find_next() {
+        if (pattern_.empty()) {
+            status_ = "no pattern";
+            return;
+        }
+        uint64_t from = base_ + top_ * row_;
+        if (match_ >= from && match_ < from + row_)
+            from = match_ + num_bytes_;
+        find(from);
+    }
+
+    // the first match from byte pos on, searched a chunk at a time
+    void find(uint64_t pos) {
+        uint64_t starts = file_.size() >= pattern_.size() ? file_.size() - pattern_.size() + 1 : 0;
+        for (; pos < starts; pos += FIND_CHUNK) {
+            uint64_t found = (uint64_t)-1;
+            search(file_.data() + pos, std::min<uint64_t>(FIND_CHUNK, starts - pos), pattern_.data(),
+                    pattern_.size(), num_bytes_, [&](size_t i) { found = std::min<uint64_t>(found, pos + i); });
+            if (found != (uint64_t)-1) {
+                match_ = found;
+                show(found);
+                status_ = string_format("found at element %llu", (unsigned long long)(found / num_bytes_));
+                return;
+            }
+        }
+        status_ = "not found";
+    }
+
+private:
+    dumper &dumper_;
+    const mapped_file &file_;
+    int num_bytes_;
+    uint64_t row_;
+    bool be_;
+    std::shared_ptr<layout_index> index_;
+    out_buffer text_;
+    uint64_t base_;
+    uint64_t top_;
+    uint64_t rows_;
+    size_t left_ = 0;
+    std::string status_;
+    std::string pattern_;
+    uint64_t match_ = (uint64_t)-1;
 };
 
 int main(int argc, char *argv[])
@@ -92,7 +1283,7 @@ int main(int argc, char *argv[])
     int stride = 32;
     app.add_option("-s,--stride", stride, "stride", true);
 
-    int count = 0;
+    uint64_t count = 0;
     app.add_option("-c,--count", count, "count");
 
     int bytes = 4;
@@ -108,7 +1299,55 @@ int main(int argc, char *argv[])
     app.add_flag("-r", reverse, "print from right to left");
 
     bool no_space = false;
-    app.add_flag("--nospace", no_space);
+    app.add_flag("--nospace", no_space, "no space between hex numbers");
+
+    std::string type_name = "hex";
+    app.add_set("--type", type_name, {"hex", "f32", "f16", "bf16", "i8", "i16", "i32", "u32"},
+            "decode numbers as this type, sets the bytes of a number", true);
+
+    int threads = 1;
+    app.add_option("--threads", threads, "encoding threads, 0 for one per core", true);
+
+    std::string diff_file;
+    CLI::Option *diff_opt = app.add_option("--diff", diff_file, "print only the strides that differ from this file");
+
+    layout_shape shape;
+    shape.add_options(&app);
+
+    bool stats = false;
+    CLI::Option *stats_opt = app.add_flag("--stats", stats, "print statistics of the numbers instead, by data and padding with --layout");
+
+    bool stats_columns = false;
+    CLI::Option *stats_columns_opt = app.add_flag("--stats-columns", stats_columns, "print statistics of every stride column instead");
+
+    std::string format_name = "dump";
+    CLI::Option *format_opt = app.add_set("--format", format_name, {"dump", "readmemh", "coe", "mif"},
+            "write a memory init file instead, a stride per word, -r puts the first number in the low bits", true);
+
+    std::string convert_file;
+    CLI::Option *convert_opt = app.add_option("--convert", convert_file, "write the numbers to this file as shown with --be and -r instead");
+
+    std::string undump_file;
+    CLI::Option *undump_opt = app.add_option("--undump", undump_file, "read the input as hex printed by dump with these options, "
+            "write the numbers to this file");
+
+    bool view = false;
+    CLI::Option *view_opt = app.add_flag("--view", view, "browse the file in the terminal, from the offset");
+
+    std::string find_text;
+    CLI::Option *find_opt = app.add_option("--find", find_text, "print where these hex numbers occur, e.g. \"deadbeef 0\"");
+
+    app.add_flag("--direct-io", direct_io(), "write --convert and --undump files with O_DIRECT and drop "
+            "the input from the page cache as it is read");
+
+    // the modes besides printing the numbers, at most one of them
+    CLI::Option *modes[] = {diff_opt, stats_opt, stats_columns_opt, format_opt, convert_opt,
+        undump_opt, view_opt, find_opt};
+    int n_modes = sizeof(modes) / sizeof(modes[0]);
+    for (int i=0; i<n_modes; i++) {
+        for (int j=i+1; j<n_modes; j++)
+            modes[i]->excludes(modes[j]);
+    }
 
     try {
         app.parse(argc, argv);
@@ -116,13 +1355,122 @@ int main(int argc, char *argv[])
         return app.exit(e);
     }
 
-    std::vector<char> data;
-    if (read_file(input_file, data, count * bytes, offset * bytes) <= 0) {
+    parallel_threads() = threads;
+
+    int type = value_type(type_name);
+    if (type != VALUE_HEX)
+        bytes = value_bytes(type);
+
+    int format = format_type(format_name);
+    if (format != FORMAT_DUMP && type != VALUE_HEX) {
+        printf("--format %s writes hex numbers only\n", format_name.c_str());
+        return -1;
+    }
+
+    dumper d(bytes, stride, reverse, be, no_space || format != FORMAT_DUMP, type);
+    d.set_format(format);
+
+    if (!undump_file.empty()) {
+        mapped_file text;
+        if (type != VALUE_HEX || !text.open(input_file)) {
+            printf("can not read hex file: \"%s\"\n", input_file.c_str());
+            return -1;
+        }
+
+        kx::file out;
+        if (!out.open(undump_file, "w")) {
+            printf("can not write file: \"%s\"\n", undump_file.c_str());
+            return -1;
+        }
+        bool ok = d.undump(text, out);
+        if (!out.close()) {
+            printf("can not write file: \"%s\"\n", undump_file.c_str());
+            return -1;
+        }
+        return ok ? 0 : -1;
+    }
+
+    mapped_file file;
+    uint64_t begin = offset * bytes;
+    if (!file.open(input_file) || begin >= file.size()) {
         printf("can not read file: \"%s\"\n", input_file.c_str());
         return -1;
     }
 
-    dumper(bytes, stride, reverse, be, no_space).dump(data);
+    uint64_t size = file.size() - begin;
+    if (count > 0)
+        size = std::min(size, count * bytes);
+
+    std::shared_ptr<layout_index> index;
+    if (!shape.type.empty()) {
+        std::shared_ptr<layout> lay = make_layout(shape);
+        if (!lay) {
+            printf("invalid shape for layout %s\n", shape.type.c_str());
+            return -1;
+        }
+        index = std::make_shared<layout_index>(lay);
+        d.set_layout(index);
+    }
+
+    if (view) {
+        viewer v(d, file, begin, bytes, stride * bytes, be, index);
+        if (!v.run()) {
+            printf("--view needs a terminal\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!diff_file.empty()) {
+        mapped_file other;
+        if (!other.open(diff_file) || begin >= other.size()) {
+            printf("can not read file: \"%s\"\n", diff_file.c_str());
+            return -1;
+        }
+        if (other.size() != file.size())
+            printf("sizes differ: %zu and %zu bytes, comparing the common part\n", file.size(), other.size());
+        fflush(stdout);
+
+        bool same = d.diff(file, other, begin, std::min(size, other.size() - begin));
+        return same && other.size() == file.size() ? 0 : 1;
+    }
+
+    if (!convert_file.empty()) {
+        struct stat in_st, out_st;
+        if (stat(convert_file.c_str(), &out_st) == 0 && stat(input_file.c_str(), &in_st) == 0 &&
+                in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+            printf("can not convert a file into itself\n");
+            return -1;
+        }
+
+        kx::file out;
+        if (!out.open(convert_file, "w")) {
+            printf("can not write file: \"%s\"\n", convert_file.c_str());
+            return -1;
+        }
+        bool ok = d.convert(file, begin, size, out);
+        if (!out.close() || !ok) {
+            printf("can not write file: \"%s\"\n", convert_file.c_str());
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!find_text.empty()) {
+        std::string pat;
+        if (!parse_pattern(find_text, bytes, be, &pat)) {
+            printf("invalid pattern: \"%s\"\n", find_text.c_str());
+            return -1;
+        }
+        return d.find(file, begin, size, pat) ? 0 : 1;
+    }
+
+    if (stats || stats_columns) {
+        d.stats(file, begin, size, stats_columns);
+        return 0;
+    }
+
+    d.dump(file, begin, size);
 
     return 0;
 }
@@ -10,9 +10,27 @@
 #define _KX_FILE_H
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <vector>
 #include <string>
+#include <memory>
+#include <new>
+#include <algorithm>
+
+// O_DIRECT alignment of memory, offsets and sizes when the file system
+// does not report its own
+#define DIRECT_ALIGN 4096
+
+// staging buffer of O_DIRECT transfers the caller's buffer can not take
+#define DIRECT_BOUNCE (4 << 20)
 
 namespace kx {
 
@@ -36,50 +54,291 @@ std::string string_format(const char* fmt, Args... args)
     return buf;
 }
 
+// --direct-io: files are opened with O_DIRECT, so big blobs do not go
+// through the page cache
+static bool &direct_io()
+{
+    static bool direct = false;
+    return direct;
+}
+
+// Uninitialized memory aligned for O_DIRECT transfers.
+class aligned_buffer: private noncopyable {
+public:
+    explicit aligned_buffer(size_t size, size_t align = DIRECT_ALIGN): size_(size) {
+        if (posix_memalign((void **)&data_, align, std::max<size_t>(size, 1)) != 0)
+            throw std::bad_alloc();
+    }
+    ~aligned_buffer() { free(data_); }
+
+    char *data() { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    char *data_ = NULL;
+    size_t size_;
+};
+
+// A file on a descriptor: the size comes from fstat and every read or
+// write is a pread/pwrite loop straight between the caller's buffer and
+// the kernel, with 64 bit offsets and no stdio buffer in between. An
+// offset of 0 continues where the last call stopped, as the stdio
+// version did.
+//
+// With direct_io() the file is opened with O_DIRECT where the file system
+// allows it. Aligned parts of a transfer still go straight to the caller's
+// buffer; the rest is staged in an aligned bounce buffer, and a write
+// covering part of a block reads the block first and truncates the
+// padding off again.
 class file: private noncopyable {
 public:
-    ~file() { if (fp_) fclose(fp_); }
+    ~file() { close(); }
 
+    // mode as for fopen: "r", "w", "a", optionally with "+" and "b"
     bool open(const std::string &filename, const std::string &mode) {
-        fp_ = fopen(filename.c_str(), mode.c_str());
-        if (!fp_)
+        int flags;
+        switch (mode.empty() ? 0 : mode[0]) {
+        case 'r': flags = 0; break;
+        case 'w': flags = O_CREAT | O_TRUNC; break;
+        case 'a': flags = O_CREAT | O_APPEND; break;
+        default: return false;
+        }
+        // O_APPEND writes can not be placed on a block, and writing part
+        // of a block reads it first
+        direct_ = direct_io() && mode[0] != 'a';
+        bool update = mode.find('+') != std::string::npos || (direct_ && mode[0] != 'r');
+        flags |= update ? O_RDWR : (mode[0] == 'r' ? O_RDONLY : O_WRONLY);
+
+        fd_ = ::open(filename.c_str(), flags | O_CLOEXEC | (direct_ ? O_DIRECT : 0), 0644);
+        if (fd_ < 0 && direct_ && errno == EINVAL) {
+            direct_ = false;
+            fd_ = ::open(filename.c_str(), flags | O_CLOEXEC, 0644);
+        }
+        if (fd_ < 0)
             return false;
 
-        fseek(fp_, 0, SEEK_END);
-        size_ = ftell(fp_);
-        fseek(fp_, 0, SEEK_SET);
+        struct stat st;
+        if (fstat(fd_, &st) < 0) {
+            close();
+            return false;
+        }
+        size_ = st.st_size;
+        pos_ = mode[0] == 'a' ? size_ : 0;
+        align_ = direct_ ? direct_align(fd_) : 1;
         return true;
     }
 
+    bool close() {
+        int fd = fd_;
+        fd_ = -1;
+        return fd < 0 || ::close(fd) == 0;
+    }
+
     size_t read(void *data, size_t size, off_t offset = 0) {
-        if (offset > 0) {
-            if (-1 == fseek(fp_, offset, SEEK_SET))
+        if (offset > 0)
+            pos_ = offset;
+
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = read_some((char *)data + done, size - done, pos_ + done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
                 return -1;
+            if (n == 0)
+                break;
+            done += n;
         }
+        pos_ += done;
+        return done;
+    }
+
+    size_t write(const void *data, size_t size, off_t offset = 0) {
+        if (offset > 0)
+            pos_ = offset;
+
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = write_some((const char *)data + done, size - done, pos_ + done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return done ? done : -1;
+            done += n;
+        }
+        pos_ += done;
+        size_ = std::max(size_, (size_t)pos_);
+        return done;
+    }
+
+    size_t size() {
+        return size_;
+    }
+
+    int fd() const { return fd_; }
 
-        size_t ret = fread(data, 1, size, fp_);
+    // Whether the descriptor is O_DIRECT, so anything bypassing read()
+    // and write() must transfer whole blocks of align() bytes from
+    // aligned memory.
+    bool direct() const { return direct_; }
+    size_t align() const { return align_; }
+    size_t align_up(size_t size) const { return (size + align_ - 1) / align_ * align_; }
+
+private:
+    static size_t direct_align(int fd) {
+#ifdef STATX_DIOALIGN
+        struct statx stx;
+        if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN) &&
+                stx.stx_dio_mem_align && stx.stx_dio_offset_align)
+            return std::max(stx.stx_dio_mem_align, stx.stx_dio_offset_align);
+#endif
+        return DIRECT_ALIGN;
+    }
+
+    // the bytes of size at p that can go to the kernel as they are
+    size_t aligned_bytes(const char *p, size_t size, off_t at) const {
+        if (!direct_)
+            return size;
+        if ((uintptr_t)p % align_ || at % align_)
+            return 0;
+        return size / align_ * align_;
+    }
 
-        if (ferror(fp_))
+    char *bounce() {
+        if (!bounce_)
+            bounce_.reset(new aligned_buffer(DIRECT_BOUNCE, align_));
+        return bounce_->data();
+    }
+
+    // a block at off, zeros past the end of the file
+    bool read_block(char *b, off_t off) {
+        memset(b, 0, align_);
+        return pread(fd_, b, align_, off) >= 0;
+    }
+
+    ssize_t read_some(char *p, size_t size, off_t at) {
+        size_t body = aligned_bytes(p, size, at);
+        if (body)
+            return pread(fd_, p, body, at);
+
+        off_t start = at / align_ * align_;
+        size_t head = at - start;
+        size_t len = std::min<size_t>(DIRECT_BOUNCE, align_up(head + size));
+        ssize_t n = pread(fd_, bounce(), len, start);
+        if (n <= (ssize_t)head)
+            return n < 0 ? -1 : 0;
+
+        n = std::min(n - head, size);
+        memcpy(p, bounce_->data() + head, n);
+        return n;
+    }
+
+    ssize_t write_some(const char *p, size_t size, off_t at) {
+        size_t body = aligned_bytes(p, size, at);
+        if (body)
+            return pwrite(fd_, p, body, at);
+
+        off_t start = at / align_ * align_;
+        size_t head = at - start;
+        size_t len = std::min<size_t>(DIRECT_BOUNCE, align_up(head + size));
+        size_t n = std::min(size, len - head);
+        char *b = bounce();
+        struct stat st;
+        if (fstat(fd_, &st) < 0)
             return -1;
 
-        return ret;
+        if (head && !read_block(b, start))
+            return -1;
+        if ((head + n) % align_ && !(head && len == align_) && !read_block(b + len - align_, start + len - align_))
+            return -1;
+        memcpy(b + head, p, n);
+
+        ssize_t w = pwrite(fd_, b, len, start);
+        if (w != (ssize_t)len) {
+            errno = w < 0 ? errno : EIO;
+            return -1;
+        }
+        if (start + (off_t)len > st.st_size && ftruncate(fd_, std::max<off_t>(st.st_size, at + n)) < 0)
+            return -1;
+        return n;
     }
 
-    size_t write(const void *data, size_t size, off_t offset = 0) {
-        if (offset > 0) {
-            if (-1 == fseek(fp_, offset, SEEK_SET))
-                return -1;
+private:
+    size_t size_ = 0;
+    off_t pos_ = 0;
+    int fd_ = -1;
+    bool direct_ = false;
+    size_t align_ = 1;
+    std::unique_ptr<aligned_buffer> bounce_;
+};
+
+// Read-only view of a whole file, for scanning files larger than we want
+// to copy into memory.
+class mapped_file: private noncopyable {
+public:
+    ~mapped_file() {
+        if (data_)
+            munmap(data_, size_);
+        if (fd_ >= 0) {
+            posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd_);
         }
-        return fwrite(data, 1, size, fp_);
     }
 
-    size_t size() {
-        return size_;
+    bool open(const std::string &filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            close(fd);
+            return false;
+        }
+
+        size_ = st.st_size;
+        if (size_ > 0) {
+            void *p = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                return false;
+            }
+            data_ = (char *)p;
+            madvise(data_, size_, MADV_SEQUENTIAL);
+        }
+
+        if (direct_io())
+            fd_ = fd;
+        else
+            close(fd);
+        return true;
+    }
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+    // Drops the pages fully inside [offset, offset + size) from this
+    // process, for streaming over a file larger than memory. They are
+    // read back from the page cache if touched again. A mapping can not
+    // be O_DIRECT, so with direct_io() the page cache is dropped as well,
+    // from the start of the file: it holds large folios, which straddle
+    // the released ranges and only go once wholly inside one. The rest
+    // goes when the file is closed.
+    void release(size_t offset, size_t size) const {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t begin = (offset + page - 1) / page * page;
+        size_t end = std::min(offset + size, size_) / page * page;
+        if (end > begin) {
+            madvise(data_ + begin, end - begin, MADV_DONTNEED);
+            if (fd_ >= 0)
+                posix_fadvise(fd_, 0, end, POSIX_FADV_DONTNEED);
+        }
     }
 
 private:
+    char *data_ = NULL;
     size_t size_ = 0;
-    FILE *fp_ = NULL;
+    int fd_ = -1;
 };
 
 static size_t read_file(const std::string &filename, void *data, size_t size, off_t offset = 0)
@@ -110,7 +369,7 @@ static size_t read_file(const std::string &filename, std::vector<T> &data, size_
 
     data.resize(size);
 
-    return file.read(&data[0], data.size()*sizeof(T), offset*sizeof(T));
+    return file.read(data.data(), data.size()*sizeof(T), offset*sizeof(T));
 }
 
 static size_t write_file(const std::string &filename, const void *data, size_t size, off_t offset = 0)
@@ -125,7 +384,7 @@ static size_t write_file(const std::string &filename, const void *data, size_t s
 template<typename T>
 static int write_file(const std::string &filename, const std::vector<T> &data, off_t offset = 0)
 {
-    return write_file(filename, &data[0], data.size()*sizeof(T), offset);
+    return write_file(filename, data.data(), data.size()*sizeof(T), offset);
 }
 
 }
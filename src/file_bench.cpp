@@ -0,0 +1,172 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: file_bench.cpp
+ *     Created: 2018-05-18 10:05
+ * Description: kx::file against the stdio version it replaced, and with O_DIRECT
+ * ===================================================
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "file.h"
+#include "profile.h"
+#include "CLI11.hpp"
+
+using namespace kx;
+
+// kx::file as it was: fopen, size by fseek/ftell, fseek + fread/fwrite
+class stdio_file: private noncopyable {
+public:
+    ~stdio_file() { if (fp_) fclose(fp_); }
+
+    bool open(const std::string &filename, const std::string &mode) {
+        fp_ = fopen(filename.c_str(), mode.c_str());
+        if (!fp_)
+            return false;
+
+        fseek(fp_, 0, SEEK_END);
+        size_ = ftell(fp_);
+        fseek(fp_, 0, SEEK_SET);
+        return true;
+    }
+
+    size_t read(void *data, size_t size, off_t offset = 0) {
+        if (offset > 0) {
+            if (-1 == fseek(fp_, offset, SEEK_SET))
+                return -1;
+        }
+
+        size_t ret = fread(data, 1, size, fp_);
+
+        if (ferror(fp_))
+            return -1;
+
+        return ret;
+    }
+
+    size_t write(const void *data, size_t size, off_t offset = 0) {
+        if (offset > 0) {
+            if (-1 == fseek(fp_, offset, SEEK_SET))
+                return -1;
+        }
+        return fwrite(data, 1, size, fp_);
+    }
+
+    size_t size() {
+        return size_;
+    }
+
+private:
+    size_t size_ = 0;
+    FILE *fp_ = NULL;
+};
+
+// Writes the file to disk and drops it from the page cache, so the next
+// read comes from the device and the next write does not wait for the
+// writeback of the last one.
+static void drop_cache(const std::string &filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static void report(const char *name, const char *op, uint64_t bytes, uint64_t ns, bool ok)
+{
+    printf("%-6s %-12s %10.3f %9.3f %s\n", name, op, ns / 1e9, gbps(bytes, ns), ok ? "" : "FAILED");
+}
+
+// The calls load_file/save_file make: the whole buffer at once, then in
+// blocks at explicit offsets.
+template<class F>
+static void bench(const char *name, const std::string &filename, std::vector<char> &buf, size_t block)
+{
+    std::vector<char> back(buf.size());
+    size_t size = buf.size();
+    bool ok;
+
+    drop_cache(filename);
+    uint64_t t = now_ns();
+    {
+        F f;
+        ok = f.open(filename, "w") && f.write(&buf[0], size) == size;
+    }
+    report(name, "write", size, now_ns() - t, ok);
+
+    drop_cache(filename);
+    t = now_ns();
+    {
+        F f;
+        ok = f.open(filename, "r") && f.size() == size && f.read(&back[0], size) == size;
+    }
+    report(name, "read cold", size, now_ns() - t, ok && back == buf);
+
+    t = now_ns();
+    {
+        F f;
+        ok = f.open(filename, "r") && f.read(&back[0], size) == size;
+    }
+    report(name, "read warm", size, now_ns() - t, ok && back == buf);
+
+    t = now_ns();
+    {
+        F f;
+        ok = f.open(filename, "r");
+        for (size_t off=0; ok && off<size; off+=block) {
+            size_t n = std::min(block, size - off);
+            ok = f.read(&back[off], n, off) == n;
+        }
+    }
+    report(name, "read blocks", size, now_ns() - t, ok && back == buf);
+
+    drop_cache(filename);
+    t = now_ns();
+    {
+        F f;
+        ok = f.open(filename, "w");
+        for (size_t off=0; ok && off<size; off+=block) {
+            size_t n = std::min(block, size - off);
+            ok = f.write(&buf[off], n, off) == n;
+        }
+    }
+    report(name, "write blocks", size, now_ns() - t, ok);
+}
+
+int main(int argc, char *argv[])
+{
+    CLI::App app{"kx::file benchmark"};
+
+    std::string filename;
+    app.add_option("--file", filename, "scratch file to write and read, removed at the end")->required();
+
+    size_t size_mb = 2048;
+    app.add_option("--size", size_mb, "file size in MB", true);
+
+    size_t block_kb = 1024;
+    app.add_option("--block", block_kb, "block size in KB of the block tests", true);
+
+    try {
+        app.parse(argc, argv);
+    } catch (const CLI::ParseError &e) {
+        return app.exit(e);
+    }
+
+    std::vector<char> buf(size_mb << 20);
+    for (size_t i=0; i<buf.size(); i+=sizeof(uint64_t)) {
+        uint64_t v = i * 0x9e3779b97f4a7c15ull;
+        memcpy(&buf[i], &v, sizeof(v));
+    }
+
+    printf("%-6s %-12s %10s %9s\n", "file", "op", "time(s)", "GB/s");
+    bench<stdio_file>("stdio", filename, buf, block_kb << 10);
+    bench<file>("fd", filename, buf, block_kb << 10);
+    direct_io() = true;
+    bench<file>("direct", filename, buf, block_kb << 10);
+    unlink(filename.c_str());
+
+    return 0;
+}
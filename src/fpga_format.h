@@ -13,8 +13,12 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <algorithm>
 #include <vector>
 #include "file.h"
+#include "aio.h"
+#include "profile.h"
+#include "parallel.h"
 
 #define STRIDE 32
 #define HALF_STRIDE (STRIDE/2)
@@ -42,22 +46,96 @@ static void transpose(const F *src, F *dst, int d0, int d1, int d2, int d3)
     }
 }
 
+// The blocks of the write are in flight together on the aio() engine.
+template<class F>
+bool save_file(const std::string &filename, const std::vector<F> &data)
+{
+    file out;
+    {
+        stage_scope scope(STAGE_OPEN);
+        if (!out.open(filename, "w"))
+            return false;
+    }
+
+    size_t size = data.size()*sizeof(F);
+    stage_scope scope(STAGE_WRITE, size);
+    if (size == 0)
+        return true;
+    if (!out.direct())
+        return aio().wait(aio().submit(out.fd(), (void *)data.data(), size, 0, true)) == size;
+
+    // O_DIRECT writes whole blocks from aligned memory, the padding of
+    // the last one is truncated off again
+    aligned_buffer buf(out.align_up(size), out.align());
+    memcpy(buf.data(), data.data(), size);
+    memset(buf.data() + size, 0, buf.size() - size);
+    return aio().wait(aio().submit(out.fd(), buf.data(), buf.size(), 0, true)) == buf.size() &&
+        ftruncate(out.fd(), size) == 0;
+}
+
+// The blocks of the read are in flight together on the aio() engine.
+template<class F>
+bool load_file(const std::string &filename, std::vector<F> &data)
+{
+    file in;
+    {
+        stage_scope scope(STAGE_OPEN);
+        if (!in.open(filename, "r"))
+            return false;
+    }
+
+    stage_scope scope(STAGE_READ, in.size());
+    data.resize(in.size()/sizeof(F));
+    size_t size = data.size()*sizeof(F);
+    if (size == 0)
+        return true;
+    if (!in.direct())
+        return aio().wait(aio().submit(in.fd(), data.data(), size, 0, false)) == size;
+
+    // O_DIRECT reads whole blocks into aligned memory, the last one
+    // short at the end of the file
+    aligned_buffer buf(in.align_up(size), in.align());
+    size_t n = aio().wait(aio().submit(in.fd(), buf.data(), buf.size(), 0, false));
+    if (n == (size_t)-1 || n < size)
+        return false;
+    memcpy(data.data(), buf.data(), size);
+    return true;
+}
+
 template<class T, class F>
 bool format_to_fpga(T &t, std::vector<F> &output,
         const std::string &input_file,
         const std::string &output_file = "")
 {
     std::vector<F> input;
-    if (!read_file(input_file, input))
+    if (!load_file(input_file, input))
         return false;
 
-    bool ret = t.format(input, output);
+    bool ret;
+    {
+        stage_scope scope(STAGE_FORMAT, (input.size() + t.size())*sizeof(F));
+        ret = t.format(input, output);
+    }
+    prof().set_elements(input.size(), t.size());
+
     if (ret && !output_file.empty())
-        write_file(output_file, output);
+        save_file(output_file, output);
 
     return ret;
 }
 
+// Runs t.format_cell over all cells in parallel, cells_per_task() cells
+// at a time so a task owns whole cache lines of the output.
+template<class T, class F>
+void format_cells(T &t, const F *input, F *output)
+{
+    size_t cell_src = t.cell_src();
+    parallel_for(STAGE_FORMAT, t.cells(), t.cells_per_task(), [&](size_t begin, size_t end) {
+        for (size_t cell=begin; cell<end; cell++)
+            t.format_cell(cell, input + cell*cell_src, output);
+    });
+}
+
 template<class T, class F>
 bool format_to_fpga(T &t, const F *src, int size, std::vector<F> &output)
 {
@@ -83,8 +161,8 @@ struct weight {
     }
 
     int dim_;
-    int block_w_convs_;
-    int block_h_convs_;
+    int block_w_convs_ = 0;
+    int block_h_convs_ = 0;
     int block_pad_w_;
     int inputs_;
     int outputs_;
@@ -92,7 +170,12 @@ struct weight {
     int conv_w() { return dim_; }
     int conv_h() { return dim_*dim_; }
     int conv_size() { return conv_w() * conv_h(); }
-    int size() { return STRIDE * cell_h() * outputs_/2; }
+    int size() { return STRIDE * cell_h() * round_up(outputs_, 2)/2; }
+
+    // two cells share the rows of a cell_h() * STRIDE block
+    int cells() { return outputs_; }
+    int cell_src() { return inputs_*dim_*dim_; }
+    int cells_per_task() { return 2; }
 
     int block_convs() { return block_w_convs_ * block_h_convs_; }
     int block_w() { return block_w_convs_ * conv_w(); }
@@ -114,9 +197,38 @@ struct weight {
         return (h_convs*conv_h() + sub_conv*dim_) * STRIDE + w_convs * conv_w();
     }
 
+    // locate(addr + period) is locate(addr) plus step, except in the last
+    // period of the blob
+    int period(int *step) {
+        step[0] = 2; step[1] = 0; step[2] = 0; step[3] = 0;
+        return cell_h() * STRIDE;
+    }
+
+    // inverse of fill_conv, coord: {cell, conv, sub_conv, n}
+    bool locate(int addr, int *coord) {
+        int row = addr / STRIDE;
+        int col = addr % HALF_STRIDE;
+        int r = row % cell_h();
+        int w_convs = col / dim_;
+        int y = col % dim_;
+        int sub_conv = (r % conv_h()) / dim_;
+        int x = (r % conv_h()) % dim_;
+
+        coord[0] = (row / cell_h()) * 2 + ((addr % STRIDE) >= HALF_STRIDE ? 1 : 0);
+        coord[1] = (r / conv_h()) * block_w_convs_ + w_convs;
+        coord[2] = sub_conv;
+        coord[3] = x * dim_ + (y - sub_conv + dim_) % dim_;
+
+        if (w_convs >= block_w_convs_ || coord[0] >= outputs_ || coord[1] >= inputs_) {
+            coord[0] = -1;
+            return false;
+        }
+        return true;
+    }
+
     template<class F>
     void fill_conv(int cell, int conv,
-            const F *pconv, std::vector<F> &output) {
+            const F *pconv, F *output) {
         int cell_addr = get_cell_addr(cell);
         int count = dim_*dim_;
 
@@ -139,16 +251,16 @@ struct weight {
             return false;
 
         output = std::vector<F>(size(), 0);
-
-        for (int cell=0; cell<outputs_; cell++) {
-            for (int conv=0; conv<inputs_; conv++) {
-                const F *pconv = &input[(cell*inputs_+conv)*dim_*dim_];
-                fill_conv(cell, conv, pconv, output);
-            }
-        }
+        format_cells(*this, &input[0], &output[0]);
 
         return true;
     }
+
+    template<class F>
+    void format_cell(int cell, const F *src, F *output) {
+        for (int conv=0; conv<inputs_; conv++)
+            fill_conv(cell, conv, src + conv*dim_*dim_, output);
+    }
 };
 
 class conv_fcw {
@@ -171,26 +283,53 @@ public:
         return addr;
     }
 
+    int period(int *step) {
+        step[0] = 1; step[1] = 0; step[2] = 0;
+        return cell_size_;
+    }
+
+    // inverse of get_addr, coord: {cell, input, index}
+    bool locate(int addr, int *coord) {
+        int r = addr % cell_size_;
+        int n = (r / STRIDE) * HALF_STRIDE + r % HALF_STRIDE;
+
+        coord[0] = addr / cell_size_;
+        coord[1] = (n / (dim_*dim_)) * 2 + ((r % STRIDE) >= HALF_STRIDE ? 1 : 0);
+        coord[2] = n % (dim_*dim_);
+
+        if (coord[0] >= outputs_ || coord[1] >= inputs_) {
+            coord[0] = -1;
+            return false;
+        }
+        return true;
+    }
+
     int group_size() { return group_n_stride_*HALF_STRIDE; }
     int size() { return cell_size_ * outputs_; }
 
+    int cells() { return outputs_; }
+    int cell_src() { return inputs_*dim_*dim_; }
+    int cells_per_task() { return 1; }
+
     template<class F>
     bool format(const std::vector<F> &input, std::vector<F> &output) {
         if ((int)input.size() < outputs_*inputs_*dim_*dim_)
             return false;
 
         output = std::vector<F>(size(), 0);
+        format_cells(*this, &input[0], &output[0]);
 
+        return true;
+    }
+
+    template<class F>
+    void format_cell(int cell, const F *src, F *output) {
         int n = 0;
-        for (int i=0; i<outputs_; i++) {
-            for (int j=0; j<inputs_; j++) {
-                for (int k=0; k<dim_*dim_; k++) {
-                    output[get_addr(i, j, k)] = input[n++];
-                }
+        for (int j=0; j<inputs_; j++) {
+            for (int k=0; k<dim_*dim_; k++) {
+                output[get_addr(cell, j, k)] = src[n++];
             }
         }
-
-        return true;
     }
 
 private:
@@ -215,23 +354,43 @@ public:
     int cell_size() { return cell_n_stride_ * STRIDE; }
     int size() { return outputs_ * cell_size(); }
 
+    int cells() { return outputs_; }
+    int cell_src() { return inputs_; }
+    int cells_per_task() { return 1; }
+
+    int period(int *step) {
+        step[0] = 1; step[1] = 0;
+        return cell_size();
+    }
+
+    // coord: {cell, input}
+    bool locate(int addr, int *coord) {
+        coord[0] = addr / cell_size();
+        coord[1] = addr % cell_size();
+
+        if (coord[0] >= outputs_ || coord[1] >= inputs_) {
+            coord[0] = -1;
+            return false;
+        }
+        return true;
+    }
+
     template<class F>
     bool format(const std::vector<F> &input, std::vector<F> &output) {
         if ((int)input.size() < outputs_*inputs_)
             return false;
 
         output = std::vector<F>(size(), 0);
-        const F *in = &input[0];
-
-        for (int cell=0; cell<outputs_; cell++) {
-            F *out = &output[get_cell_addr(cell)];
-            memcpy(out, in, inputs_*sizeof(F));
-            in += inputs_;
-        }
+        format_cells(*this, &input[0], &output[0]);
 
         return true;
     }
 
+    template<class F>
+    void format_cell(int cell, const F *src, F *output) {
+        memcpy(output + get_cell_addr(cell), src, inputs_*sizeof(F));
+    }
+
 private:
     const int block_n_stride_ = 12;
 
@@ -248,6 +407,21 @@ public:
     int get_bias_addr(int index) { return (index/2)*stride_ + (index%2); }
     int size() { return (inputs_/2) * stride_; }
 
+    int period(int *step) {
+        step[0] = 2;
+        return stride_;
+    }
+
+    // coord: {index}
+    bool locate(int addr, int *coord) {
+        coord[0] = (addr/stride_)*2 + addr%stride_;
+        if (addr%stride_ >= 2 || coord[0] >= inputs_) {
+            coord[0] = -1;
+            return false;
+        }
+        return true;
+    }
+
     template<class F>
     bool format(const std::vector<F> &input, std::vector<F> &output) {
         if ((int)input.size() < inputs_)
@@ -274,6 +448,21 @@ public:
     int get_bias_addr(int index) { return index*stride_; }
     int size() { return inputs_ * stride_; }
 
+    int period(int *step) {
+        step[0] = 1;
+        return stride_;
+    }
+
+    // coord: {index}
+    bool locate(int addr, int *coord) {
+        coord[0] = addr/stride_;
+        if (addr%stride_ != 0 || coord[0] >= inputs_) {
+            coord[0] = -1;
+            return false;
+        }
+        return true;
+    }
+
     template<class F>
     bool format(const std::vector<F> &input, std::vector<F> &output) {
         if ((int)input.size() < inputs_)
@@ -317,7 +506,7 @@ struct feature_maps {
     int conv_h_;
     int img_origin_h_;
     int img_count_;
-    int stride_imgs_;
+    int stride_imgs_ = 0;
     int img_h_;
     int pad0_ = 0;
     int pad1_ = 0;
@@ -327,6 +516,12 @@ struct feature_maps {
     int round_size() { return  round_h_imgs() * part_num() * img_h_ * STRIDE; }
     int size() { return round_num() * round_size(); }
 
+    // a task formats a group of images, the ones writing the same rows
+    // (see kept_parts)
+    int cells() { return img_count_; }
+    int cell_src() { return img_origin_h_*img_origin_h_; }
+    int cells_per_task() { return stride_imgs_; }
+
     int part_num() { return img_h_/conv_h_; }
     int part_size() { return img_h_*conv_h_; }
     int map_size() { return img_h_*img_h_; }
@@ -345,43 +540,110 @@ struct feature_maps {
         return x * STRIDE + y;
     }
 
-    template<class F>
-    void pad_input(const std::vector<F> &src, std::vector<F> &dst) {
-        dst = std::vector<F>(img_h_*img_h_*img_count_, 0);
+    // groups and parts overlap, so there is no period
+    int period(int *step) { return 0; }
+
+    // inverse of img_addr/pixel_addr, coord: {img, part, pixel}. Image
+    // groups and parts share rows (group + part), an address resolves to
+    // the image format wrote last. Pixels of the same-conv border are
+    // located but reported as padding.
+    bool locate(int addr, int *coord) {
+        int col = addr % STRIDE;
+        int x = (addr / STRIDE) % img_h_;
+        int rows = addr / (img_h_ * STRIDE);
+        int half = stride_imgs_ / 2;
+
+        coord[0] = -1;
+        if (col >= half * conv_h_) {
+            col -= map_pad();
+            if (col < half * conv_h_)
+                return false;
+        }
+
+        int slot = col / conv_h_;
+        int y = col % conv_h_;
+        if (slot >= stride_imgs_)
+            return false;
+
+        int group = std::min(rows, (img_count_ - 1) / stride_imgs_);
+        if (group * stride_imgs_ + slot >= img_count_)
+            group--;
+
+        int part = rows - group;
+        if (group < 0 || part >= part_num())
+            return false;
 
-        const F *psrc = &src[0];
-        F *pdst = &dst[0] + pad0_ * img_h_ + pad0_;
-        int diff = img_h_ - img_origin_h_ + 1;
+        coord[0] = group * stride_imgs_ + slot;
+        coord[1] = part;
+        coord[2] = y * img_h_ + x;
 
-        for (int i=0; i<img_count_ * img_origin_h_; i++) {
-            memcpy(pdst, psrc, img_origin_h_*sizeof(F));
-            psrc += img_origin_h_;
-            pdst += ((i+1)%img_origin_h_ == 0) ? (diff*img_h_) : img_h_;
+        int img_y = part * conv_h_ + y - pad0_;
+        int img_x = x - pad0_;
+        return img_y >= 0 && img_y < img_origin_h_ && img_x >= 0 && img_x < img_origin_h_;
+    }
+
+    // dst must be a zeroed map_size() buffer
+    template<class F>
+    void pad_image(const F *src, F *dst) {
+        dst += pad0_ * img_h_ + pad0_;
+        for (int i=0; i<img_origin_h_; i++) {
+            memcpy(dst, src, img_origin_h_*sizeof(F));
+            src += img_origin_h_;
+            dst += img_h_;
         }
     }
 
+    template<class F>
+    void pad_input(const std::vector<F> &src, std::vector<F> &dst) {
+        dst = std::vector<F>(map_size()*img_count_, 0);
+
+        for (int img=0; img<img_count_; img++)
+            pad_image(&src[img*cell_src()], &dst[img*map_size()]);
+    }
+
     template<class F>
     bool format(const std::vector<F> &input1, std::vector<F> &output) {
         if ((int)input1.size() != img_origin_h_ * img_origin_h_ * img_count_)
             return false;
 
         std::vector<F> input;
-        pad_input(input1, input);
+        {
+            stage_scope scope(STAGE_PAD, (input1.size() + img_h_*img_h_*img_count_)*sizeof(F));
+            pad_input(input1, input);
+        }
         output.resize(size());
 
-        const F *in = &input[0];
-        F *out = &output[0];
-
-        for (int img=0; img<img_count_; img++) {
-            for (int part=0; part<part_num(); part++) {
-                int addr = img_addr(img, part);
-                in += fill_part(addr, in, out);
-            }
-        }
+        parallel_for(STAGE_FORMAT, img_count_, cells_per_task(), [&](size_t begin, size_t end) {
+            for (size_t img=begin; img<end; img++)
+                fill_img(img, &input[img*map_size()], &output[0]);
+        });
 
         return true;
     }
 
+    template<class F>
+    void format_cell(int img, const F *src, F *output) {
+        std::vector<F> padded(map_size(), 0);
+        pad_image(src, &padded[0]);
+        fill_img(img, &padded[0], output);
+    }
+
+    // Part p of a group shares its rows with part 0 of the group p later
+    // (see locate), which overwrites it. Only the last group of a slot
+    // keeps all its parts, so an image writes no address another one
+    // writes and the images can be formatted in any order.
+    int kept_parts(int img) {
+        return img + stride_imgs_ < img_count_ ? 1 : part_num();
+    }
+
+    template<class F>
+    void fill_img(int img, const F *in, F *out) {
+        for (int part=0; part<kept_parts(img); part++) {
+            int addr = img_addr(img, part);
+            in += fill_part(addr, in, out);
+        }
+    }
+
     template<class F>
     int fill_part(int addr, const F *in, F *out) {
         for (int i=0; i<part_size(); i++) {
@@ -401,6 +663,23 @@ public:
 
     int size() { return (inputs_/2) * STRIDE; }
 
+    int period(int *step) {
+        step[0] = 2; step[1] = 0;
+        return STRIDE;
+    }
+
+    // coord: {index, 0 for weight or 1 for bias}
+    bool locate(int addr, int *coord) {
+        int col = addr % STRIDE;
+        coord[0] = (addr/STRIDE)*2 + col%2;
+        coord[1] = col/2;
+        if (col >= 4 || coord[0] >= inputs_) {
+            coord[0] = -1;
+            return false;
+        }
+        return true;
+    }
+
     template<class F>
     bool format(const void *pDataW, const void *pDataB, std::vector<F> &output) {
         const F *pweight = (const F *)pDataW;
@@ -428,6 +707,23 @@ public:
 
     int size() { return inputs_ * STRIDE; }
 
+    int period(int *step) {
+        step[0] = 1; step[1] = 0;
+        return STRIDE;
+    }
+
+    // coord: {index, 0 for weight or 1 for bias}
+    bool locate(int addr, int *coord) {
+        int col = addr % STRIDE;
+        coord[0] = addr/STRIDE;
+        coord[1] = col/2;
+        if ((col != 0 && col != 2) || coord[0] >= inputs_) {
+            coord[0] = -1;
+            return false;
+        }
+        return true;
+    }
+
     template<class F>
     bool format(const void *pDataW, const void *pDataB, std::vector<F> &output) {
         const F *pweight = (const F *)pDataW;
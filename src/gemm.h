@@ -0,0 +1,126 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: gemm.h
+ *     Created: 2018-05-14 10:20
+ * Description: cache blocked matrix multiply for reference engines
+ * ===================================================
+ */
+#ifndef _KX_GEMM_H
+#define _KX_GEMM_H
+
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// k is walked in blocks of GEMM_KC so the rows of b used by a block stay
+// in L1 while every row of a passes over them.
+#define GEMM_KC 256
+
+namespace kx {
+
+static inline float dot(const float *a, const float *b, int k)
+{
+    int i = 0;
+    float sum = 0;
+#ifdef __SSE2__
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= k; i += 4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    sum = _mm_cvtss_f32(acc);
+#endif
+    for (; i < k; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+#ifdef __SSE2__
+static inline float hsum(__m128 v)
+{
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+// c[4][2] += a[4][k] . b[2][k]; 8 accumulators and 6 loads fit the 16
+// xmm registers.
+static inline void sgemm_nt_4x2(int k, const float *a, int lda,
+        const float *b, int ldb, float *c, int ldc)
+{
+    __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps();
+    __m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+    __m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps();
+    __m128 c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+    int i = 0;
+
+    for (; i + 4 <= k; i += 4) {
+        __m128 b0 = _mm_loadu_ps(b + i);
+        __m128 b1 = _mm_loadu_ps(b + ldb + i);
+        __m128 a0 = _mm_loadu_ps(a + i);
+        __m128 a1 = _mm_loadu_ps(a + lda + i);
+        __m128 a2 = _mm_loadu_ps(a + 2*lda + i);
+        __m128 a3 = _mm_loadu_ps(a + 3*lda + i);
+        c00 = _mm_add_ps(c00, _mm_mul_ps(a0, b0)); c01 = _mm_add_ps(c01, _mm_mul_ps(a0, b1));
+        c10 = _mm_add_ps(c10, _mm_mul_ps(a1, b0)); c11 = _mm_add_ps(c11, _mm_mul_ps(a1, b1));
+        c20 = _mm_add_ps(c20, _mm_mul_ps(a2, b0)); c21 = _mm_add_ps(c21, _mm_mul_ps(a2, b1));
+        c30 = _mm_add_ps(c30, _mm_mul_ps(a3, b0)); c31 = _mm_add_ps(c31, _mm_mul_ps(a3, b1));
+    }
+
+    float r[4][2] = {
+        { hsum(c00), hsum(c01) }, { hsum(c10), hsum(c11) },
+        { hsum(c20), hsum(c21) }, { hsum(c30), hsum(c31) },
+    };
+    for (; i < k; i++) {
+        for (int x=0; x<4; x++) {
+            r[x][0] += a[x*lda + i] * b[i];
+            r[x][1] += a[x*lda + i] * b[ldb + i];
+        }
+    }
+
+    for (int x=0; x<4; x++) {
+        c[x*ldc] += r[x][0];
+        c[x*ldc + 1] += r[x][1];
+    }
+}
+#endif
+
+// c[m][n] += a[m][k] . b[n][k]^T, all row-major. b being transposed
+// keeps both operands contiguous along k, which is what im2col produces.
+//
+// Only k is blocked. conv_ref calls this with n <= CONV_NB pixels, so a
+// whole call streams a once, at 2 * CONV_NB flops per number loaded, and
+// the weights of the layers we model (9.4 MB for 512x512x3x3) are read
+// from L3. Blocking m and n over larger pixel blocks was tried, with
+// 64x64 panels and 64 or 128 pixels per call, and ran no faster: the 4x2
+// kernel is bound by its arithmetic, and fewer pixel blocks would leave
+// threads idle on small images.
+static void sgemm_nt(int m, int n, int k, const float *a, int lda,
+        const float *b, int ldb, float *c, int ldc)
+{
+    for (int k0=0; k0<k; k0+=GEMM_KC) {
+        int kc = std::min(GEMM_KC, k - k0);
+        int i = 0;
+#ifdef __SSE2__
+        for (; i + 4 <= m; i += 4) {
+            int j = 0;
+            for (; j + 2 <= n; j += 2)
+                sgemm_nt_4x2(kc, a + i*lda + k0, lda, b + j*ldb + k0, ldb, c + i*ldc + j, ldc);
+            for (; j < n; j++) {
+                for (int x=0; x<4; x++)
+                    c[(i+x)*ldc + j] += dot(a + (i+x)*lda + k0, b + j*ldb + k0, kc);
+            }
+        }
+#endif
+        for (; i < m; i++) {
+            for (int j=0; j<n; j++)
+                c[i*ldc + j] += dot(a + i*lda + k0, b + j*ldb + k0, kc);
+        }
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,280 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: layout.h
+ *     Created: 2018-05-07 16:30
+ * Description: fpga layouts selected at runtime by name
+ * ===================================================
+ */
+#ifndef _KX_LAYOUT_H
+#define _KX_LAYOUT_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CLI11.hpp"
+#include "fpga_format.h"
+
+#define LAYOUT_COORDS 4
+
+// bytes of the element a layout address counts, a 32 bit fpga word
+#define LAYOUT_WORD 4
+
+struct layout_shape {
+    std::string type;
+    int dim = 1;
+    int inputs = 0;
+    int outputs = 0;
+    int img_h = 0;
+    int channel = 1;
+    bool same_conv = false;
+
+    void add_options(CLI::App *sub) {
+        sub->add_set("--layout", type, {"weight", "convfcw", "fcfcw", "bias", "fcbias", "bnconv", "bnfc", "img"},
+                "the fpga layout of the file");
+        sub->add_set("--dim", dim, {1,3,5,7}, "the dim of conv");
+        sub->add_option("--inputs", inputs, "input count");
+        sub->add_option("--outputs", outputs, "output count");
+        sub->add_option("--imgh", img_h, "img height");
+        sub->add_option("--channel", channel, "the channel of img, default 1");
+        sub->add_flag("--same-conv", same_conv, "padding by same conv");
+    }
+};
+
+class layout {
+public:
+    layout(const char *const *names): names_(names) {}
+    virtual ~layout() {}
+
+    virtual int size() = 0;
+
+    // Maps an element address of the formatted blob back to the logical
+    // coordinate it was formatted from. Returns false for padding, in
+    // which case coord[0] is -1 unless the padding still has a position
+    // (the same-conv border of an img).
+    virtual bool locate(int addr, int *coord) = 0;
+
+    // Words after which locate() repeats shifted by step, 0 if it does
+    // not; see layout_index.
+    virtual int period(int *step) = 0;
+
+    const char *const *coord_names() { return names_; }
+
+    std::string describe(int addr) {
+        int coord[LAYOUT_COORDS];
+        bool data = locate(addr, coord);
+        return describe(coord, data);
+    }
+
+    std::string describe(const int *coord, bool data) {
+        if (coord[0] < 0)
+            return "pad";
+
+        std::string s;
+        for (int i=0; names_[i]; i++)
+            s += string_format("%s%s %d", i ? " " : "", names_[i], coord[i]);
+        if (!data)
+            s += " pad";
+        return s;
+    }
+
+private:
+    const char *const *names_;
+};
+
+template<class T>
+class layout_of: public layout {
+public:
+    layout_of(const T &t, const char *const *names): layout(names), t_(t) {}
+
+    int size() { return t_.size(); }
+    bool locate(int addr, int *coord) { return t_.locate(addr, coord); }
+    int period(int *step) { return t_.period(step); }
+
+private:
+    T t_;
+};
+
+template<class T>
+static std::shared_ptr<layout> new_layout(const T &t, const char *const *names)
+{
+    return std::make_shared<layout_of<T> >(t, names);
+}
+
+static std::shared_ptr<layout> make_layout(const layout_shape &s)
+{
+    static const char *cell_conv[] = {"cell", "conv", "sub_conv", "n", NULL};
+    static const char *cell_input_index[] = {"cell", "input", "index", NULL};
+    static const char *cell_input[] = {"cell", "input", NULL};
+    static const char *index[] = {"index", NULL};
+    static const char *index_bias[] = {"index", "bias", NULL};
+    static const char *img_part[] = {"img", "part", "pixel", NULL};
+
+    bool io = s.inputs > 0 && s.outputs > 0;
+
+    if (s.type == "weight" && io)
+        return new_layout(weight(s.dim, s.inputs, s.outputs), cell_conv);
+    if (s.type == "convfcw" && io && s.inputs % 2 == 0)
+        return new_layout(conv_fcw(s.dim, s.inputs, s.outputs), cell_input_index);
+    if (s.type == "fcfcw" && io)
+        return new_layout(fc_fcw(s.inputs, s.outputs), cell_input);
+    if (s.type == "bias" && s.inputs > 0)
+        return new_layout(bias(s.inputs), index);
+    if (s.type == "fcbias" && s.inputs > 0)
+        return new_layout(fc_bias(s.inputs), index);
+    if (s.type == "bnconv" && s.inputs > 0)
+        return new_layout(bn_conv(s.inputs), index_bias);
+    if (s.type == "bnfc" && s.inputs > 0)
+        return new_layout(bn_fc(s.inputs), index_bias);
+    if (s.type == "img" && s.img_h > 0 && s.channel > 0)
+        return new_layout(feature_maps(s.dim, s.img_h, s.channel, 1, s.same_conv), img_part);
+
+    return NULL;
+}
+
+// Inverse address tables of a layout: locate() of the first period of
+// the blob, which every later period repeats shifted by the period step.
+// Only the last period, where cells may run out, and layouts without a
+// period are located directly.
+class layout_index {
+public:
+    layout_index(const std::shared_ptr<layout> &l): layout_(l) {
+        size_ = l->size();
+        int step[LAYOUT_COORDS] = {0};
+        period_ = l->period(step);
+        if (period_ <= 0 || 2 * (size_t)period_ > size_) {
+            period_ = 0;
+            return;
+        }
+
+        table_.resize(period_);
+        for (int i=0; i<period_; i++)
+            table_[i].data = l->locate(i, table_[i].coord);
+        for (int i=0; i<LAYOUT_COORDS; i++)
+            step_[i] = step[i];
+        periods_ = (size_ - 1) / period_;
+    }
+
+    const std::shared_ptr<layout> &get() const { return layout_; }
+    size_t size() const { return size_; }
+
+    // like layout::locate, addresses past the blob are padding
+    bool locate(size_t addr, int *coord) const {
+        if (addr >= size_) {
+            coord[0] = -1;
+            return false;
+        }
+
+        size_t q = period_ ? addr / period_ : 0;
+        if (q >= periods_)
+            return layout_->locate(addr, coord);
+
+        const entry &e = table_[addr - q * period_];
+        for (int i=0; i<LAYOUT_COORDS; i++)
+            coord[i] = e.coord[i] + (e.coord[0] < 0 ? 0 : q * step_[i]);
+        return e.data;
+    }
+
+    // locate() of the n addresses from addr, stepping through the table
+    // without a division per address. Fills data[] and, if any address
+    // has a position, first[] and first_data with the first one; returns
+    // whether one has.
+    bool locate_run(size_t addr, int n, bool *data, int *first, bool *first_data) const {
+        int coord[LAYOUT_COORDS];
+        bool found = false;
+        size_t q = period_ ? addr / period_ : 0;
+        size_t r = period_ ? addr - q * period_ : 0;
+
+        for (int i=0; i<n; i++) {
+            if (q < periods_) {
+                const entry &e = table_[r];
+                data[i] = e.data;
+                if (!found && e.coord[0] >= 0) {
+                    for (int k=0; k<LAYOUT_COORDS; k++)
+                        first[k] = e.coord[k] + q * step_[k];
+                    *first_data = e.data;
+                    found = true;
+                }
+                if (++r == (size_t)period_) {
+                    r = 0;
+                    q++;
+                }
+                continue;
+            }
+
+            data[i] = locate(addr + i, coord);
+            if (!found && coord[0] >= 0) {
+                std::copy(coord, coord + LAYOUT_COORDS, first);
+                *first_data = data[i];
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    // The first address holding the data at coord, which has a value for
+    // every coordinate name of the layout. An entry of the first period
+    // matches when coord is the same whole number of steps from it in
+    // every coordinate; only the last period, and layouts without a
+    // period, are searched address by address.
+    bool find(const int *coord, size_t *addr) const {
+        const char *const *names = layout_->coord_names();
+        int count = 0;
+        while (names[count])
+            count++;
+
+        size_t best = size_;
+        for (int r=0; r<period_; r++) {
+            const entry &e = table_[r];
+            if (!e.data)
+                continue;
+
+            int64_t q = -1;
+            bool match = true;
+            for (int i=0; i<count && match; i++) {
+                int64_t d = (int64_t)coord[i] - e.coord[i];
+                if (step_[i] == 0) {
+                    match = d == 0;
+                    continue;
+                }
+                int64_t k = d / step_[i];
+                match = d % step_[i] == 0 && k >= 0 && (q < 0 || k == q);
+                q = k;
+            }
+
+            size_t a = r + (q < 0 ? 0 : q) * (size_t)period_;
+            if (match && q < (int64_t)periods_ && a < best)
+                best = a;
+        }
+        if (best < size_) {
+            *addr = best;
+            return true;
+        }
+
+        int c[LAYOUT_COORDS];
+        for (size_t a=periods_ * period_; a<size_; a++) {
+            if (layout_->locate(a, c) && std::equal(c, c + count, coord)) {
+                *addr = a;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct entry {
+        int coord[LAYOUT_COORDS];
+        bool data;
+    };
+
+    std::shared_ptr<layout> layout_;
+    size_t size_;
+    int period_ = 0;
+    size_t periods_ = 0;
+    int step_[LAYOUT_COORDS] = {0};
+    std::vector<entry> table_;
+};
+
+#endif
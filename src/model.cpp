@@ -11,9 +11,16 @@
 #include <assert.h>
 #include <string.h>
 #include <random>
+#include <inttypes.h>
 
 #include "CLI11.hpp"
 #include "fpga_format.h"
+#include "layout.h"
+#include "simd.h"
+#include "random.h"
+#include "parallel.h"
+#include "pattern.h"
+#include "reference.h"
 
 using namespace kx;
 
@@ -47,31 +54,86 @@ public:
         max_ = max;
     }
 
-     operator uint32_t () {
+    void set_seed(uint64_t seed) {
+        stream_ = rand_stream(seed);
+    }
+
+    // Number i of the sequence only depends on the seed and i.
+    template<class T>
+    void fill(T *out, size_t begin, size_t n) const {
+        uint64_t buf[RAND_BLOCK];
+
+        for (size_t i=0; i<n; i+=RAND_BLOCK) {
+            size_t count = std::min(n - i, (size_t)RAND_BLOCK);
+            stream_.fill(buf, begin + i, count);
+            for (size_t j=0; j<count; j++)
+                out[i+j] = value(buf[j], (T *)NULL);
+        }
+    }
+
+    template<class T>
+    void fill(std::vector<T> &data) const {
+        parallel_for(STAGE_GENERATE, data.size(), 64*RAND_BLOCK, [&](size_t begin, size_t end) {
+            fill(&data[begin], begin, end - begin);
+        });
+    }
+
+private:
+    uint32_t value(uint64_t r, uint32_t *) const {
         if (min_ == max_)
             return min_;
 
-        return min_ + rd() % (max_ - min_);
+        return min_ + (uint32_t)(((r >> 32) * (max_ - min_)) >> 32);
     }
 
-     operator float () {
+    float value(uint64_t r, float *) const {
         if (min_ == max_)
             return min_;
 
-        uint32_t n = min_ + rd() % (max_ - min_);
-        return (float)n + (float)(rd() % 0xffff) / 0xffff;
+        uint32_t n = min_ + (uint32_t)(((r >> 32) * (max_ - min_)) >> 32);
+        return (float)n + (float)(r & 0xffffff) / 0x1000000;
     }
 
 private:
-    std::random_device rd;
+    rand_stream stream_;
     uint32_t min_ = 0;
     uint32_t max_ = RAND_MAX;
 };
 
-class param_t {
+class command_t {
 public:
-    param_t(const std::string &cmd, const std::string &desc) {
+    command_t(const std::string &cmd, const std::string &desc) {
         sub = app.add_subcommand(cmd, desc);
+        sub->add_flag("--stats", show_stats, "print time and throughput of each stage");
+        sub->add_flag("--perf-counters", perf_counters, "print hardware counters of each stage");
+        sub->add_option("--threads", threads, "worker threads, default one per core");
+    }
+
+    virtual ~command_t() {}
+    virtual bool run() = 0;
+    virtual bool init() {
+        if (!sub || !*sub)
+            return false;
+
+        parallel_threads() = threads;
+        return true;
+    }
+
+    std::string name() { return sub ? sub->get_name() : ""; }
+    int profile_flags() {
+        return (show_stats ? PROFILE_STATS : 0) | (perf_counters ? PROFILE_PERF : 0);
+    }
+
+protected:
+    CLI::App* sub = NULL;
+    bool show_stats = false;
+    bool perf_counters = false;
+    int threads = 0;
+};
+
+class param_t: public command_t {
+public:
+    param_t(const std::string &cmd, const std::string &desc): command_t(cmd, desc) {
         sub->add_option("--output", output_file, "the file to write")->required();
         sub->add_option("--wstep", w_step, "w_step");
         sub->add_option("--cstep", c_step, "c_step");
@@ -80,30 +142,77 @@ public:
         sub->add_flag("-f,--float", use_float, "use float");
         sub->add_flag("--rand", use_rand, "rand");
         sub->add_flag("--save-src", save_src, "save xxx.bin.src file");
+        seed_opt = sub->add_option("--seed", seed, "seed of --rand, default a random one");
     }
 
-    virtual ~param_t() {}
-    virtual bool run() = 0;
     bool init() {
         if (r_max < r_min) {
             r_max = r_min;
         }
 
+        if (!command_t::init())
+            return false;
+
+        if (use_rand && !seed_opt->count()) {
+            std::random_device rdev;
+            seed = ((uint64_t)rdev() << 32) | rdev();
+            printf("%s seed %" PRIu64 "\n", name().c_str(), seed);
+        }
+
         rd.set_min_max(r_min, r_max);
+        rd.set_seed(seed);
 
-        return sub && *sub;
+        return true;
     }
 
-    std::string name() { return sub ? sub->get_name() : ""; }
+protected:
+    // Generates the source of layout l one cell at a time through
+    // make_cell(cell, src). Unless --save-src wants the whole source,
+    // every cell is formatted right after it is generated, so the source
+    // never exists in memory beyond one cell per worker.
+    template<class L, class T, class G>
+    void make(L &l, std::vector<T> &output, G make_cell) {
+        size_t cell_src = l.cell_src();
+        size_t src_size = l.cells() * cell_src;
+        prof().set_elements(src_size, l.size());
+
+        if (save_src) {
+            std::vector<T> input(src_size);
+            {
+                stage_scope scope(STAGE_GENERATE, src_size*sizeof(T));
+                parallel_for(STAGE_GENERATE, l.cells(), l.cells_per_task(), [&](size_t begin, size_t end) {
+                    for (size_t cell=begin; cell<end; cell++)
+                        make_cell(cell, &input[cell*cell_src]);
+                });
+            }
+
+            save_file(output_file + ".src", input);
+
+            stage_scope scope(STAGE_FORMAT, (src_size + l.size())*sizeof(T));
+            l.format(input, output);
+            return;
+        }
+
+        stage_scope scope(STAGE_FUSED, l.size()*sizeof(T));
+        output = std::vector<T>(l.size(), 0);
+        parallel_for(STAGE_FUSED, l.cells(), l.cells_per_task(), [&](size_t begin, size_t end) {
+            std::vector<T> src(cell_src);
+            for (size_t cell=begin; cell<end; cell++) {
+                make_cell(cell, &src[0]);
+                l.format_cell(cell, &src[0], &output[0]);
+            }
+        });
+    }
 
 protected:
-    CLI::App* sub = NULL;
     std::string output_file;
     bool use_float = false;
     bool save_src = false;
     bool use_rand = false;
     std::vector<uint32_t> rand_range = {1, 0};
     xrand rd;
+    uint64_t seed = 0;
+    CLI::Option *seed_opt = NULL;
     int w_step = 0;
     int c_step = 0;
     int r_min = 0;
@@ -127,7 +236,6 @@ public:
 
 private:
     std::string input_file;
-    std::string output_file;
     int dim_;
     int inputs;
     int outputs;
@@ -222,7 +330,7 @@ public:
     }
 
     bool run() {
-        feature_maps fms(dim, img_h, channel, same_conv);
+        feature_maps fms(dim, img_h, channel, 1, same_conv);
         std::vector<uint32_t> output;
         return format_to_fpga(fms, output, input_file, output_file);
     }
@@ -245,46 +353,34 @@ public:
 
     bool run() {
         if (use_float)
-            _run<float>();
+            return _run<float>();
         else
-            _run<uint32_t>();
-
-        return true;
+            return _run<uint32_t>();
     }
 
     template<class T>
     bool _run() {
-        std::vector<T> input;
-        std::vector<T> output;
-        make_input(input);
-
-        if (save_src) {
-            write_file(output_file + ".src", input);
-        }
-
         weight w(dim, inputs, outputs);
-        w.format(input, output);
-        write_file(output_file, output);
-
-        return true;
+        std::vector<T> output;
+        make(w, output, [&](int cell, T *src) { make_cell(cell, src); });
+        return save_file(output_file, output);
     }
 
     template<class T>
-    void make_input(std::vector<T> &input) {
+    void make_cell(int i, T *src) {
         int size = dim*dim;
-        input = std::vector<T>(outputs*inputs*size, 0);
-
-        int n = 0;
+        if (use_rand) {
+            rd.fill(src, (size_t)i*inputs*size, inputs*size);
+            return;
+        }
 
-        for (int i=0; i<outputs; i++) {
-            for (int j=0; j<inputs; j++) {
+        for (int j=0; j<inputs; j++) {
 
-                uint32_t base = r_min + i*c_step + j*w_step;
-                uint32_t v = base;
+            uint32_t base = r_min + i*c_step + j*w_step;
+            uint32_t v = base;
 
-                for (int k=0; k<size; k++) {
-                    input[n++] = use_rand ? rd : vnext(v, base, r_min, r_max);
-                }
+            for (int k=0; k<size; k++) {
+                *src++ = vnext(v, base, r_min, r_max);
             }
         }
     }
@@ -304,42 +400,50 @@ public:
 
     bool run() {
         if (use_float)
-            _run<float>();
+            return _run<float>();
         else
-            _run<uint32_t>();
-
-        return true;
+            return _run<uint32_t>();
     }
 
     template<class T>
     bool _run() {
         std::vector<T> input;
         std::vector<T> output;
-        make_input(input);
+        {
+            stage_scope scope(STAGE_GENERATE);
+            make_input(input);
+            scope.set_bytes(input.size()*sizeof(T));
+        }
 
         if (save_src) {
-            write_file(output_file + ".src", input);
+            save_file(output_file + ".src", input);
         }
 
         A b(inputs);
-        b.format(input, output);
-        write_file(output_file, output);
-
-        return true;
+        {
+            stage_scope scope(STAGE_FORMAT, (input.size() + b.size())*sizeof(T));
+            b.format(input, output);
+        }
+        prof().set_elements(input.size(), b.size());
+        return save_file(output_file, output);
     }
 
     template<class T>
     void make_input(std::vector<T> &input) {
         input = std::vector<T>(inputs, 0);
+        if (use_rand) {
+            rd.fill(input);
+            return;
+        }
 
         uint32_t v = r_min;
         if (c_step == 0)
             c_step = 1;
 
         for (size_t i=0; i<input.size(); i++) {
-            if (v > r_max)
+            if (v > (uint32_t)r_max)
                 v = r_min;
-            input[i] = use_rand ? rd : v;
+            input[i] = v;
             v += c_step;
         }
     }
@@ -358,43 +462,32 @@ public:
 
     bool run() {
         if (use_float)
-            _run<float>();
+            return _run<float>();
         else
-            _run<uint32_t>();
-
-        return true;
+            return _run<uint32_t>();
     }
 
 
     template<class T>
     bool _run() {
-        std::vector<T> input;
-        std::vector<T> output;
-        make_input(input);
-
-        if (save_src) {
-            write_file(output_file + ".src", input);
-        }
-
         conv_fcw w(dim_, inputs, outputs);
-        w.format(input, output);
-        write_file(output_file, output);
-
-        return true;
+        std::vector<T> output;
+        make(w, output, [&](int cell, T *src) { make_cell(cell, src); });
+        return save_file(output_file, output);
     }
 
     template<class T>
-    void make_input(std::vector<T> &input) {
-        input = std::vector<T>(inputs*outputs*dim_*dim_, 0);
+    void make_cell(int i, T *src) {
+        int size = inputs*dim_*dim_;
+        if (use_rand) {
+            rd.fill(src, (size_t)i*size, size);
+            return;
+        }
 
-        for (int i=0; i<outputs; i++) {
-            uint32_t base = r_min + i*c_step;
-            uint32_t v = base;
-            for (int j=0; j<inputs; j++) {
-                for (int k=0; k<dim_*dim_; k++) {
-                    input[i*inputs + j*dim_*dim_ + k] = use_rand ? rd : vnext(v, base, r_min, r_max);
-                }
-            }
+        uint32_t base = r_min + i*c_step;
+        uint32_t v = base;
+        for (int n=0; n<size; n++) {
+            src[n] = vnext(v, base, r_min, r_max);
         }
     }
 
@@ -414,43 +507,32 @@ public:
 
     bool run() {
         if (use_float)
-            _run<float>();
+            return _run<float>();
         else
-            _run<uint32_t>();
-
-        return true;
+            return _run<uint32_t>();
     }
 
 
     template<class T>
     bool _run() {
-        std::vector<T> input;
-        std::vector<T> output;
-        make_input(input);
-
-        if (save_src) {
-            write_file(output_file + ".src", input);
-        }
-
         A w(inputs, outputs);
-        w.format(input, output);
-        write_file(output_file, output);
-
-        return true;
+        std::vector<T> output;
+        make(w, output, [&](int cell, T *src) { make_cell(cell, src); });
+        return save_file(output_file, output);
     }
 
     template<class T>
-    void make_input(std::vector<T> &input) {
-        input = std::vector<T>(inputs*outputs, 0);
+    void make_cell(int i, T *src) {
+        if (use_rand) {
+            rd.fill(src, (size_t)i*inputs, inputs);
+            return;
+        }
 
-        for (int i=0; i<outputs; i++) {
-            int n = 0;
-            uint32_t base = r_min + i*c_step;
-            uint32_t v = base;
+        uint32_t base = r_min + i*c_step;
+        uint32_t v = base;
 
-            for (int j=0; j<inputs; j++, n++) {
-                input[i*inputs + n] = use_rand ? rd : vnext(v, base, r_min, r_max);
-            }
+        for (int j=0; j<inputs; j++) {
+            src[j] = vnext(v, base, r_min, r_max);
         }
     }
 
@@ -468,11 +550,9 @@ public:
 
     bool run() {
         if (use_float)
-            _run<float>();
+            return _run<float>();
         else
-            _run<uint32_t>();
-
-        return true;
+            return _run<uint32_t>();
     }
 
     template<class T>
@@ -480,31 +560,41 @@ public:
         std::vector<T> input;
         std::vector<T> output;
 
-        make_input(input);
+        {
+            stage_scope scope(STAGE_GENERATE);
+            make_input(input);
+            scope.set_bytes(input.size()*sizeof(T));
+        }
 
         if (save_src) {
-            write_file(output_file + ".src", input);
+            save_file(output_file + ".src", input);
         }
 
         A b(inputs);
-        b.format(&input[0], &input[0], output);
-        write_file(output_file, output);
-
-        return true;
+        {
+            stage_scope scope(STAGE_FORMAT, (input.size() + b.size())*sizeof(T));
+            b.format(&input[0], &input[0], output);
+        }
+        prof().set_elements(input.size(), b.size());
+        return save_file(output_file, output);
     }
 
     template<class T>
     void make_input(std::vector<T> &input) {
         input = std::vector<T>(inputs, 0);
+        if (use_rand) {
+            rd.fill(input);
+            return;
+        }
 
         uint32_t v = r_min;
         if (c_step == 0)
             c_step = 1;
 
         for (size_t i=0; i<input.size(); i++) {
-            if (v > r_max)
+            if (v > (uint32_t)r_max)
                 v = r_min;
-            input[i] = use_rand ? rd : v;
+            input[i] = v;
             v += c_step;
         }
     }
@@ -527,57 +617,64 @@ public:
 
     bool run() {
         if (use_float)
-            _run<float>();
+            return _run<float>();
         else
-            _run<uint32_t>();
-
-        return true;
+            return _run<uint32_t>();
     }
 
     template<class T>
-    void _run() {
-        std::vector<T> input;
+    bool _run() {
         std::vector<T> output;
-        make_input(input);
-
-        if (save_src) {
-            write_file(output_file + ".src", input);
-        }
 
         if (for_fm) {
-            feature_maps fms(dim, img_h, channel, same_conv);
-            fms.format(input, output);
+            feature_maps fms(dim, img_h, channel, 1, same_conv);
+            make(fms, output, [&](int img, T *src) { make_map(img, src); });
         } else {
-            output = input;
+            {
+                stage_scope scope(STAGE_GENERATE);
+                make_input(output);
+                scope.set_bytes(output.size()*sizeof(T));
+            }
+
+            if (save_src) {
+                save_file(output_file + ".src", output);
+            }
+            prof().set_elements(output.size(), output.size());
         }
 
-        write_file(output_file, output);
+        return save_file(output_file, output);
+    }
+
+    template<class T>
+    void make_map(int k, T *src) {
+        if (use_rand) {
+            rd.fill(src, (size_t)k*img_h*img_h, img_h*img_h);
+            return;
+        }
+
+        uint32_t base = r_min + k*f_step;
+        uint32_t v = base;
+        for (int i=0; i<img_h*img_h; i++) {
+            src[i] = vnext(v, base, r_min, r_max);
+        }
     }
 
     template<class T>
     void make_input(std::vector<T> &input) {
         input = std::vector<T>(channel*img_h*img_h, 0);
+        if (use_rand) {
+            rd.fill(input);
+            return;
+        }
 
         int n = 0;
         uint32_t v = 0;
 
-        if (for_fm) {
-            for (int k=0; k<channel; k++) {
-                uint32_t base = r_min + k*f_step;
-                v = base;
-                for (int i=0; i<img_h; i++) {
-                    for (int j=0; j<img_h; j++) {
-                        input[n++] = use_rand ? rd : vnext(v, base, r_min, r_max);
-                    }
-                }
-            }
-        } else {
-            for (int i=0; i<img_h; i++) {
-                for (int j=0; j<img_h; j++) {
-                    v++;
-                    for (int k=0; k<channel; k++) {
-                        input[n++] = use_rand ? rd : v;
-                    }
+        for (int i=0; i<img_h; i++) {
+            for (int j=0; j<img_h; j++) {
+                v++;
+                for (int k=0; k<channel; k++) {
+                    input[n++] = v;
                 }
             }
         }
@@ -590,12 +687,485 @@ private:
     bool same_conv = false;
     bool for_fm = false;
     bool fm_inc_one_by_one = false;
-    int f_step;
+    int f_step = 0;
+};
+
+class verify_param_t: public command_t {
+public:
+    verify_param_t(): command_t("verify", "compare a formatted file with a golden one") {
+        sub->add_option("--input", input_file, "the file to check")->required();
+        sub->add_option("--golden", golden_file, "the expected file")->required();
+        sub->add_set("-b,--bytes", bytes, {1,2,4,8}, "the bytes of a number", true);
+        sub->add_option("--max", max_report, "print at most this many mismatches", true);
+        shape.add_options(sub);
+    }
+
+    bool run() {
+        mapped_file in, golden;
+        if (!in.open(input_file) || !golden.open(golden_file)) {
+            printf("can not read file: \"%s\" or \"%s\"\n", input_file.c_str(), golden_file.c_str());
+            return false;
+        }
+
+        if (!shape.type.empty()) {
+            lay = make_layout(shape);
+            if (!lay) {
+                printf("invalid shape for layout %s\n", shape.type.c_str());
+                return false;
+            }
+        }
+
+        if (in.size() != golden.size())
+            printf("size differs: %zu != %zu bytes\n", in.size(), golden.size());
+
+        size_t size = std::min(in.size(), golden.size());
+        size_t mismatches = 0;
+        size_t off = 0;
+        {
+            stage_scope scope(STAGE_COMPARE, size*2);
+            while ((off += mismatch(in.data() + off, golden.data() + off, size - off)) < size) {
+                size_t index = off / bytes;
+                if (mismatches++ < max_report)
+                    report(index, in.data(), golden.data(), size);
+                off = std::min<size_t>(size, (index + 1) * bytes);
+            }
+        }
+
+        if (mismatches > max_report)
+            printf("... %zu more\n", mismatches - max_report);
+        printf("%zu mismatches in %zu numbers\n", mismatches, (size + bytes - 1) / bytes);
+
+        return mismatches == 0 && in.size() == golden.size();
+    }
+
+private:
+    void report(size_t index, const char *a, const char *b, size_t size) {
+        size_t off = index * bytes;
+        int n = std::min((size_t)bytes, size - off);
+
+        printf("addr 0x%08zx: %s != %s", index, hex(a + off, n).c_str(), hex(b + off, n).c_str());
+        if (lay) {
+            // layout addresses count 32 bit words
+            size_t word = off / LAYOUT_WORD;
+            if (word < (size_t)lay->size())
+                printf("  %s", lay->describe(word).c_str());
+            else
+                printf("  beyond %s", shape.type.c_str());
+        }
+        printf("\n");
+    }
+
+    static std::string hex(const char *p, int n) {
+        std::string s;
+        for (int i=n-1; i>=0; i--)
+            s += string_format("%02x", p[i] & 0xff);
+        return s;
+    }
+
+private:
+    std::string input_file;
+    std::string golden_file;
+    int bytes = 4;
+    size_t max_report = 32;
+    layout_shape shape;
+    std::shared_ptr<layout> lay;
+};
+
+class make_pattern_param_t: public command_t {
+public:
+    make_pattern_param_t(): command_t("make-pattern", "make a dma diagnostic pattern in fpga layout") {
+        sub->add_option("--output", output_file, "the file to write")->required();
+        sub->add_set("--pattern", pattern_name, {"addr", "walk1", "checker", "cellsig"}, "the pattern")->required();
+        shape.add_options(sub);
+    }
+
+    bool run() {
+        std::shared_ptr<layout> lay = make_layout(shape);
+        if (!lay) {
+            printf("invalid shape for layout \"%s\"\n", shape.type.c_str());
+            return false;
+        }
+
+        pattern p(pattern_type(pattern_name), lay);
+        std::vector<uint32_t> output(lay->size());
+        {
+            stage_scope scope(STAGE_GENERATE, output.size()*sizeof(uint32_t));
+            parallel_for(STAGE_GENERATE, output.size(), PATTERN_CHUNK, [&](size_t begin, size_t end) {
+                p.fill(&output[begin], begin, end - begin);
+            });
+        }
+        prof().set_elements(output.size(), output.size());
+
+        return save_file(output_file, output);
+    }
+
+private:
+    std::string output_file;
+    std::string pattern_name;
+    layout_shape shape;
+};
+
+class check_pattern_param_t: public command_t {
+public:
+    check_pattern_param_t(): command_t("check-pattern", "check a readback of make-pattern") {
+        sub->add_option("--input", input_file, "the file to check")->required();
+        sub->add_set("--pattern", pattern_name, {"addr", "walk1", "checker", "cellsig"}, "the pattern")->required();
+        sub->add_option("--max", max_report, "print at most this many mismatches", true);
+        shape.add_options(sub);
+    }
+
+    bool run() {
+        mapped_file in;
+        if (!in.open(input_file)) {
+            printf("can not read file: \"%s\"\n", input_file.c_str());
+            return false;
+        }
+
+        std::shared_ptr<layout> lay;
+        if (!shape.type.empty() && !(lay = make_layout(shape))) {
+            printf("invalid shape for layout %s\n", shape.type.c_str());
+            return false;
+        }
+
+        pattern p(pattern_type(pattern_name), lay);
+        if (!p.valid()) {
+            printf("pattern %s needs --layout\n", pattern_name.c_str());
+            return false;
+        }
+
+        size_t n = in.size() / sizeof(uint32_t);
+        if (lay && n != (size_t)lay->size())
+            printf("size differs: %zu != %d numbers of %s\n", n, lay->size(), shape.type.c_str());
+
+        std::vector<result> results((n + PATTERN_CHUNK - 1) / PATTERN_CHUNK);
+        {
+            stage_scope scope(STAGE_COMPARE, n*sizeof(uint32_t));
+            parallel_for(STAGE_COMPARE, results.size(), 16, [&](size_t begin, size_t end) {
+                std::vector<uint32_t> expect(PATTERN_CHUNK);
+                for (size_t c=begin; c<end; c++)
+                    check(p, (const uint32_t *)in.data(), n, c, &expect[0], results[c]);
+            });
+        }
+
+        size_t mismatches = 0;
+        size_t reported = 0;
+        for (auto &r: results) {
+            mismatches += r.count;
+            for (size_t i=0; i<r.index.size() && reported < max_report; i++, reported++)
+                report(lay, r.index[i], ((const uint32_t *)in.data())[r.index[i]], r.expect[i]);
+        }
+
+        if (mismatches > reported)
+            printf("... %zu more\n", mismatches - reported);
+        printf("%zu mismatches in %zu numbers\n", mismatches, n);
+
+        return mismatches == 0 && (!lay || n == (size_t)lay->size());
+    }
+
+private:
+    struct result {
+        size_t count = 0;
+        std::vector<size_t> index;
+        std::vector<uint32_t> expect;
+    };
+
+    void check(const pattern &p, const uint32_t *data, size_t n, size_t chunk,
+            uint32_t *expect, result &r) {
+        size_t begin = chunk * PATTERN_CHUNK;
+        size_t count = std::min(n - begin, (size_t)PATTERN_CHUNK);
+        size_t bytes = count * sizeof(uint32_t);
+        const char *got = (const char *)(data + begin);
+        size_t off = 0;
+
+        p.fill(expect, begin, count);
+        while ((off += mismatch(got + off, (const char *)expect + off, bytes - off)) < bytes) {
+            size_t i = off / sizeof(uint32_t);
+            if (r.count++ < max_report) {
+                r.index.push_back(begin + i);
+                r.expect.push_back(expect[i]);
+            }
+            off = (i + 1) * sizeof(uint32_t);
+        }
+    }
+
+    void report(const std::shared_ptr<layout> &lay, size_t index, uint32_t got, uint32_t expect) {
+        printf("addr 0x%08zx: %08x != %08x", index, got, expect);
+        if (lay && index < (size_t)lay->size())
+            printf("  %s", lay->describe(index).c_str());
+        printf("\n");
+    }
+
+private:
+    std::string input_file;
+    std::string pattern_name;
+    size_t max_report = 32;
+    layout_shape shape;
+};
+
+template<class T>
+static bool load_numbers(const std::string &file, std::vector<T> &data, size_t size)
+{
+    if (!load_file(file, data) || data.size() < size) {
+        printf("can not read %zu numbers from \"%s\"\n", size, file.c_str());
+        return false;
+    }
+    return true;
+}
+
+// a valid conv leaves at least one output pixel
+static bool check_conv_shape(int dim, int img_h, bool same_conv)
+{
+    if (img_h <= 0) {
+        printf("img height %d must be positive\n", img_h);
+        return false;
+    }
+    if (!same_conv && img_h < dim) {
+        printf("img height %d is too small for a %dx%d conv without --same-conv\n", img_h, dim, dim);
+        return false;
+    }
+    return true;
+}
+
+class reference_conv_param_t: public command_t {
+public:
+    reference_conv_param_t(): command_t("reference-conv", "compute float conv outputs on cpu") {
+        sub->add_option("--weight", weight_file, "weight[outputs][inputs][dim][dim]")->required();
+        sub->add_option("--bias", bias_file, "bias[outputs], default 0");
+        sub->add_option("--input", input_file, "img[batch][inputs][imgh][imgh]")->required();
+        sub->add_option("--output", output_file, "the file to write, host order")->required();
+        sub->add_set("--dim", dim, {1,3,5,7}, "the dim of conv")->required();
+        sub->add_option("--inputs", inputs, "input count")->required();
+        sub->add_option("--outputs", outputs, "output count")->required();
+        sub->add_option("--imgh", img_h, "img height")->required();
+        sub->add_option("--batch", batch, "imgs of inputs channels in --input, default 1");
+        sub->add_flag("--same-conv", same_conv, "padding by same conv");
+        sub->add_option("--fm-output", fm_file, "also write the outputs in feature_maps format");
+        sub->add_set("--fm-dim", fm_dim, {1,3,5,7}, "the dim of the conv consuming --fm-output");
+        sub->add_flag("--fm-same-conv", fm_same_conv, "pad --fm-output by same conv");
+    }
+
+    bool run() {
+        if (!check_conv_shape(dim, img_h, same_conv))
+            return false;
+
+        conv_ref conv(dim, inputs, outputs, img_h, same_conv);
+        std::vector<float> w, b, img;
+
+        if (!load_numbers(weight_file, w, conv.weight_size()) ||
+                !load_numbers(input_file, img, conv.img_size() * batch) ||
+                (!bias_file.empty() && !load_numbers(bias_file, b, outputs)))
+            return false;
+
+        std::vector<float> output(conv.out_size() * batch);
+        {
+            stage_scope scope(STAGE_COMPUTE, (w.size() + img.size() + output.size())*sizeof(float));
+            conv.run(&w[0], b.empty() ? NULL : &b[0], &img[0], &output[0], batch);
+        }
+        prof().set_elements(img.size(), output.size());
+
+        if (!save_file(output_file, output))
+            return false;
+
+        if (!fm_file.empty()) {
+            feature_maps fms(fm_dim ? fm_dim : dim, conv.out_h(), outputs*batch, 1, fm_same_conv);
+            std::vector<float> fm;
+            {
+                stage_scope scope(STAGE_FORMAT, (output.size() + fms.size())*sizeof(float));
+                fms.format(output, fm);
+            }
+            return save_file(fm_file, fm);
+        }
+
+        return true;
+    }
+
+private:
+    std::string weight_file;
+    std::string bias_file;
+    std::string input_file;
+    std::string output_file;
+    std::string fm_file;
+    int dim;
+    int inputs;
+    int outputs;
+    int img_h;
+    int batch = 1;
+    bool same_conv = false;
+    int fm_dim = 0;
+    bool fm_same_conv = false;
+};
+
+class reference_fc_param_t: public command_t {
+public:
+    reference_fc_param_t(): command_t("reference-fc", "compute float fc/bn outputs on cpu from fpga blobs") {
+        sub->add_option("--weight", weight_file, "the weight in fcfcw format")->required();
+        sub->add_option("--bias", bias_file, "the bias in fcbias format, default 0");
+        sub->add_option("--bn", bn_file, "the batch norm in bnfc format, applied after the bias");
+        sub->add_option("--input", input_file, "x[batch][inputs]")->required();
+        sub->add_option("--output", output_file, "the file to write, out[batch][outputs]")->required();
+        sub->add_option("--inputs", inputs, "input count")->required();
+        sub->add_option("--outputs", outputs, "output count")->required();
+        sub->add_option("--batch", batch, "vectors in --input, default 1");
+    }
+
+    bool run() {
+        fc_layout_ref fc(inputs, outputs);
+        std::vector<float> w, b, bn, x;
+
+        if (!load_blob(weight_file, w, fc.weight_layout()) ||
+                (!bias_file.empty() && !load_blob(bias_file, b, fc.bias_layout())) ||
+                (!bn_file.empty() && !load_blob(bn_file, bn, fc.bn_layout())) ||
+                !load_numbers(input_file, x, (size_t)inputs * batch))
+            return false;
+
+        std::vector<float> output((size_t)outputs * batch);
+        {
+            stage_scope scope(STAGE_COMPUTE, (w.size() + x.size() + output.size())*sizeof(float));
+            fc.run(&w[0], b.empty() ? NULL : &b[0], bn.empty() ? NULL : &bn[0], &x[0], &output[0], batch);
+        }
+        prof().set_elements(x.size(), output.size());
+
+        return save_file(output_file, output);
+    }
+
+private:
+    template<class L>
+    static bool load_blob(const std::string &file, std::vector<float> &data, L &l) {
+        if (!load_numbers(file, data, l.size()))
+            return false;
+
+        int addr;
+        {
+            stage_scope scope(STAGE_COMPARE, l.size()*sizeof(float));
+            addr = nonzero_padding(l, &data[0]);
+        }
+        if (addr >= 0) {
+            printf("\"%s\" has data in padding at 0x%08x, wrong shape?\n", file.c_str(), addr);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::string weight_file;
+    std::string bias_file;
+    std::string bn_file;
+    std::string input_file;
+    std::string output_file;
+    int inputs;
+    int outputs;
+    int batch = 1;
+};
+
+class emulate_conv_param_t: public command_t {
+public:
+    emulate_conv_param_t(): command_t("emulate-conv", "compute fixed point conv outputs bit exact to the fpga") {
+        sub->add_option("--weight", weight_file, "weight[outputs][inputs][dim][dim]")->required();
+        sub->add_option("--bias", bias_file, "bias[outputs], default 0");
+        sub->add_option("--input", input_file, "img[batch][inputs][imgh][imgh]")->required();
+        sub->add_option("--output", output_file, "the file to write, host order")->required();
+        sub->add_set("--dim", dim, {1,3,5,7}, "the dim of conv")->required();
+        sub->add_option("--inputs", inputs, "input count")->required();
+        sub->add_option("--outputs", outputs, "output count")->required();
+        sub->add_option("--imgh", img_h, "img height")->required();
+        sub->add_option("--batch", batch, "imgs of inputs channels in --input, default 1");
+        sub->add_flag("--same-conv", same_conv, "padding by same conv");
+        fx.add_options(sub);
+    }
+
+    bool run() {
+        if (!fx.init())
+            return false;
+        if (!check_conv_shape(dim, img_h, same_conv))
+            return false;
+
+        conv_ref conv(dim, inputs, outputs, img_h, same_conv);
+        std::vector<uint32_t> w, b, img;
+
+        if (!load_numbers(weight_file, w, conv.weight_size()) ||
+                !load_numbers(input_file, img, conv.img_size() * batch) ||
+                (!bias_file.empty() && !load_numbers(bias_file, b, outputs)))
+            return false;
+
+        std::vector<uint32_t> output(conv.out_size() * batch);
+        {
+            stage_scope scope(STAGE_COMPUTE, (w.size() + img.size() + output.size())*sizeof(uint32_t));
+            conv.run_fixed(fx, &w[0], b.empty() ? NULL : &b[0], &img[0], &output[0], batch);
+        }
+        prof().set_elements(img.size(), output.size());
+
+        return save_file(output_file, output);
+    }
+
+private:
+    std::string weight_file;
+    std::string bias_file;
+    std::string input_file;
+    std::string output_file;
+    int dim;
+    int inputs;
+    int outputs;
+    int img_h;
+    int batch = 1;
+    bool same_conv = false;
+    fixed_point fx;
+};
+
+class emulate_fc_param_t: public command_t {
+public:
+    emulate_fc_param_t(): command_t("emulate-fc", "compute fixed point fc outputs bit exact to the fpga") {
+        sub->add_option("--weight", weight_file, "weight[outputs][inputs]")->required();
+        sub->add_option("--bias", bias_file, "bias[outputs], default 0");
+        sub->add_option("--input", input_file, "x[batch][inputs]")->required();
+        sub->add_option("--output", output_file, "the file to write, out[batch][outputs]")->required();
+        sub->add_option("--inputs", inputs, "input count")->required();
+        sub->add_option("--outputs", outputs, "output count")->required();
+        sub->add_option("--batch", batch, "vectors in --input, default 1");
+        fx.add_options(sub);
+    }
+
+    bool run() {
+        if (!fx.init())
+            return false;
+
+        fc_ref fc(inputs, outputs);
+        std::vector<uint32_t> w, b, x;
+
+        if (!load_numbers(weight_file, w, fc.weight_size()) ||
+                !load_numbers(input_file, x, (size_t)inputs * batch) ||
+                (!bias_file.empty() && !load_numbers(bias_file, b, outputs)))
+            return false;
+
+        std::vector<uint32_t> output((size_t)outputs * batch);
+        {
+            stage_scope scope(STAGE_COMPUTE, (w.size() + x.size() + output.size())*sizeof(uint32_t));
+            fc.run_fixed(fx, &w[0], b.empty() ? NULL : &b[0], &x[0], &output[0], batch);
+        }
+        prof().set_elements(x.size(), output.size());
+
+        return save_file(output_file, output);
+    }
+
+private:
+    std::string weight_file;
+    std::string bias_file;
+    std::string input_file;
+    std::string output_file;
+    int inputs;
+    int outputs;
+    int batch = 1;
+    fixed_point fx;
 };
 
 int main(int argc, char *argv[])
 {
-    std::vector<std::shared_ptr<param_t> > params = {
+    std::string trace_file;
+    app.add_option("--trace", trace_file, "write a chrome trace of all stages to this file");
+    app.add_set("--aio", aio_backend(), {"auto", "uring", "threads"},
+            "engine of file reads and writes, default io_uring when the kernel has it");
+    app.add_flag("--direct-io", direct_io(), "read and write files with O_DIRECT, past the page cache");
+
+    std::vector<std::shared_ptr<command_t> > params = {
         std::make_shared<format_weight_param_t>(),
         std::make_shared<format_bias_param_t>(),
         std::make_shared<format_convfcw_param_t>(),
@@ -610,6 +1180,13 @@ int main(int argc, char *argv[])
         std::make_shared<make_bn_param_t<bn_conv> >("bnconv"),
         std::make_shared<make_bn_param_t<bn_fc> >("bnfc"),
         std::make_shared<make_img_param_t>(),
+        std::make_shared<verify_param_t>(),
+        std::make_shared<make_pattern_param_t>(),
+        std::make_shared<check_pattern_param_t>(),
+        std::make_shared<reference_conv_param_t>(),
+        std::make_shared<reference_fc_param_t>(),
+        std::make_shared<emulate_conv_param_t>(),
+        std::make_shared<emulate_fc_param_t>(),
     };
 
     try {
@@ -618,11 +1195,22 @@ int main(int argc, char *argv[])
         return app.exit(e);
     }
 
+    if (!trace_file.empty())
+        prof().open_trace(trace_file);
+
+    bool ok = true;
     for (auto &param : params) {
         if (param->init()) {
-            printf("%s %s\n", param->name().c_str(), param->run() ? "done" : "failed");
+            prof().begin_layer(param->name(), param->profile_flags());
+            bool done = param->run();
+            printf("%s %s\n", param->name().c_str(), done ? "done" : "failed");
+            prof().end_layer();
+            ok = ok && done;
         }
     }
 
-    return 0;
+    if (!prof().end_run())
+        printf("can not write trace: \"%s\"\n", trace_file.c_str());
+
+    return ok ? 0 : 1;
 }
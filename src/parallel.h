@@ -0,0 +1,136 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: parallel.h
+ *     Created: 2018-05-09 14:15
+ * Description: fork/join loop over worker threads
+ * ===================================================
+ */
+#ifndef _KX_PARALLEL_H
+#define _KX_PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "profile.h"
+
+namespace kx {
+
+// Worker threads used by parallel_for, 0 means one per core.
+static int &parallel_threads()
+{
+    static int threads = 0;
+    return threads;
+}
+
+static int worker_count()
+{
+    int n = parallel_threads();
+    if (n <= 0)
+        n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+// Calls f(begin, end) for every chunk of grain items in [0, n). Chunks
+// are handed out dynamically and the caller works too; each worker is
+// traced as one span of the given stage.
+template<class F>
+static void parallel_for(int stage, size_t n, size_t grain, F f)
+{
+    if (grain == 0)
+        grain = 1;
+
+    size_t chunks = (n + grain - 1) / grain;
+    size_t threads = std::min((size_t)worker_count(), chunks);
+
+    if (threads <= 1) {
+        for (size_t i=0; i<n; i+=grain)
+            f(i, std::min(n, i+grain));
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        trace_scope span(stage);
+        size_t c;
+        while ((c = next++) < chunks)
+            f(c*grain, std::min(n, (c+1)*grain));
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t i=1; i<threads; i++)
+        pool.push_back(std::thread(worker));
+    worker();
+
+    for (auto &t: pool)
+        t.join();
+}
+
+// Runs produce(i, slot) for every i in [0, n) on worker threads and
+// consume(i, slot) for every i in order on the calling thread, slot
+// being i % slots. At most slots items are produced and not yet
+// consumed, which bounds the memory in flight.
+template<class P, class C>
+static void parallel_ordered(int stage, size_t n, size_t slots, P produce, C consume)
+{
+    size_t threads = std::min((size_t)worker_count(), n);
+
+    if (threads <= 1 || slots == 0) {
+        for (size_t i=0; i<n; i++) {
+            produce(i, 0);
+            consume(i, 0);
+        }
+        return;
+    }
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<char> ready(slots, 0);
+    size_t next = 0;
+    size_t consumed = 0;
+
+    auto worker = [&]() {
+        trace_scope span(stage);
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            cond.wait(lock, [&]() { return next >= n || next < consumed + slots; });
+            if (next >= n)
+                break;
+
+            size_t i = next++;
+            lock.unlock();
+            produce(i, i % slots);
+            lock.lock();
+
+            ready[i % slots] = 1;
+            cond.notify_all();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t i=0; i<threads; i++)
+        pool.push_back(std::thread(worker));
+
+    for (size_t i=0; i<n; i++) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&]() { return ready[i % slots] != 0; });
+        }
+        consume(i, i % slots);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        ready[i % slots] = 0;
+        consumed++;
+        cond.notify_all();
+    }
+
+    for (auto &t: pool)
+        t.join();
+}
+
+}
+
+#endif
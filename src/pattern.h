@@ -0,0 +1,113 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: pattern.h
+ *     Created: 2018-05-11 09:50
+ * Description: dma/ddr diagnostic patterns over fpga layouts
+ * ===================================================
+ */
+#ifndef _KX_PATTERN_H
+#define _KX_PATTERN_H
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "layout.h"
+
+// Fill and check in chunks of this many words; a multiple of every
+// pattern period so each chunk starts at phase 0.
+#define PATTERN_CHUNK (16*1024)
+
+enum pattern_t {
+    PATTERN_ADDR,       // the word address
+    PATTERN_WALK1,      // 1 << (addr % 32)
+    PATTERN_CHECKER,    // 0x55555555/0xaaaaaaaa, flipped every STRIDE row
+    PATTERN_CELLSIG,    // (cell << 20) | (addr & 0xfffff), 0 in padding
+};
+
+static int pattern_type(const std::string &name)
+{
+    if (name == "addr") return PATTERN_ADDR;
+    if (name == "walk1") return PATTERN_WALK1;
+    if (name == "checker") return PATTERN_CHECKER;
+    if (name == "cellsig") return PATTERN_CELLSIG;
+    return -1;
+}
+
+// Every word is a function of its address (and, for cellsig, of the cell
+// owning it), so a readback can be checked without a golden file.
+class pattern {
+public:
+    pattern(int type, const std::shared_ptr<layout> &l): type_(type), layout_(l) {
+        for (int i=0; i<2*STRIDE; i++) {
+            walk1_[i] = 1u << (i % 32);
+            checker_[i] = ((i + i/STRIDE) % 2) ? 0xaaaaaaaa : 0x55555555;
+        }
+    }
+
+    // cellsig needs the layout of the blob
+    bool valid() const { return type_ >= 0 && (type_ != PATTERN_CELLSIG || layout_); }
+
+    // begin must be a multiple of PATTERN_CHUNK unless n is the rest of
+    // the blob
+    void fill(uint32_t *out, size_t begin, size_t n) const {
+        switch (type_) {
+        case PATTERN_ADDR:    fill_addr(out, begin, n); break;
+        case PATTERN_WALK1:   fill_periodic(out, walk1_, n); break;
+        case PATTERN_CHECKER: fill_periodic(out, checker_, n); break;
+        case PATTERN_CELLSIG: fill_cellsig(out, begin, n); break;
+        }
+    }
+
+private:
+    static void fill_addr(uint32_t *out, size_t begin, size_t n) {
+        size_t i = 0;
+#ifdef __SSE2__
+        __m128i v = _mm_setr_epi32(begin, begin+1, begin+2, begin+3);
+        __m128i step = _mm_set1_epi32(4);
+        for (; i + 4 <= n; i += 4) {
+            _mm_storeu_si128((__m128i *)(out + i), v);
+            v = _mm_add_epi32(v, step);
+        }
+#endif
+        for (; i < n; i++)
+            out[i] = begin + i;
+    }
+
+    // table holds 2*STRIDE words, out starts at phase 0
+    static void fill_periodic(uint32_t *out, const uint32_t *table, size_t n) {
+        const size_t period = 2*STRIDE;
+        size_t i = 0;
+#ifdef __SSE2__
+        __m128i t[period/4];
+        for (size_t j=0; j<period/4; j++)
+            t[j] = _mm_loadu_si128((const __m128i *)(table + j*4));
+        for (; i + period <= n; i += period) {
+            for (size_t j=0; j<period/4; j++)
+                _mm_storeu_si128((__m128i *)(out + i + j*4), t[j]);
+        }
+#endif
+        for (; i < n; i++)
+            out[i] = table[i % period];
+    }
+
+    void fill_cellsig(uint32_t *out, size_t begin, size_t n) const {
+        int coord[LAYOUT_COORDS];
+        for (size_t i=0; i<n; i++) {
+            size_t addr = begin + i;
+            bool data = addr < (size_t)layout_->size() && layout_->locate(addr, coord);
+            out[i] = data ? ((uint32_t)coord[0] << 20) | (addr & 0xfffff) : 0;
+        }
+    }
+
+private:
+    int type_;
+    std::shared_ptr<layout> layout_;
+    uint32_t walk1_[2*STRIDE];
+    uint32_t checker_[2*STRIDE];
+};
+
+#endif
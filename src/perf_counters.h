@@ -0,0 +1,136 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: perf_counters.h
+ *     Created: 2018-05-03 14:20
+ * Description: hardware counters through perf_event_open
+ * ===================================================
+ */
+#ifndef _KX_PERF_COUNTERS_H
+#define _KX_PERF_COUNTERS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <string>
+#include "file.h"
+
+namespace kx {
+
+enum perf_counter_t {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_NUM,
+};
+
+static const char *perf_counter_name(int counter)
+{
+    static const char *names[PERF_NUM] = {
+        "cycles", "instructions", "LLC-misses", "dTLB-misses",
+    };
+    return (counter >= 0 && counter < PERF_NUM) ? names[counter] : "unknown";
+}
+
+// Counts the calling thread and the threads it spawns after open().
+// A counter the kernel refuses (no PMU, perf_event_paranoid, container)
+// stays closed and reads as 0; available() is false when none opened.
+class perf_counters: private noncopyable {
+public:
+    struct sample {
+        uint64_t v[PERF_NUM] = {0};
+    };
+
+    ~perf_counters() {
+        for (int i=0; i<PERF_NUM; i++) {
+            if (fds_[i] >= 0)
+                close(fds_[i]);
+        }
+    }
+
+    bool open() {
+        if (opened_)
+            return available();
+        opened_ = true;
+
+        for (int i=0; i<PERF_NUM; i++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            config(i, attr);
+
+            fds_[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+            if (fds_[i] < 0 && error_.empty())
+                error_ = string_format("%s: %s", perf_counter_name(i), strerror(errno));
+        }
+
+        return available();
+    }
+
+    bool available() const {
+        for (int i=0; i<PERF_NUM; i++) {
+            if (fds_[i] >= 0)
+                return true;
+        }
+        return false;
+    }
+
+    bool valid(int counter) const { return fds_[counter] >= 0; }
+    const std::string &error() const { return error_; }
+
+    // Values are scaled by enabled/running time when the PMU multiplexes.
+    void read(sample &s) const {
+        for (int i=0; i<PERF_NUM; i++) {
+            uint64_t buf[3];
+            s.v[i] = 0;
+            if (fds_[i] < 0 || ::read(fds_[i], buf, sizeof(buf)) != sizeof(buf))
+                continue;
+            if (buf[2] && buf[2] < buf[1])
+                s.v[i] = (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+            else
+                s.v[i] = buf[0];
+        }
+    }
+
+private:
+    static void config(int counter, struct perf_event_attr &attr) {
+        const uint64_t read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+        switch (counter) {
+        case PERF_CYCLES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PERF_INSTRUCTIONS:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PERF_LLC_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_LL | read_miss;
+            break;
+        case PERF_DTLB_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | read_miss;
+            break;
+        }
+    }
+
+private:
+    bool opened_ = false;
+    int fds_[PERF_NUM] = {-1, -1, -1, -1};
+    std::string error_;
+};
+
+}
+
+#endif
@@ -0,0 +1,293 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: profile.h
+ *     Created: 2018-05-02 10:12
+ * Description: per-stage timing and tracing of a model run
+ * ===================================================
+ */
+#ifndef _KX_PROFILE_H
+#define _KX_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <mutex>
+#include <string>
+#include "file.h"
+#include "perf_counters.h"
+#include "trace.h"
+
+namespace kx {
+
+enum stage_t {
+    STAGE_GENERATE,
+    STAGE_OPEN,
+    STAGE_READ,
+    STAGE_PAD,
+    STAGE_FORMAT,
+    STAGE_WRITE,
+    STAGE_COMPARE,
+    STAGE_FUSED,
+    STAGE_COMPUTE,
+    STAGE_NUM,
+};
+
+enum profile_flag_t {
+    PROFILE_STATS = 1,
+    PROFILE_PERF = 2,
+    PROFILE_TRACE = 4,
+};
+
+static const char *stage_name(int stage)
+{
+    static const char *names[STAGE_NUM] = {
+        "generate", "open", "read", "pad", "format", "write", "compare", "fused", "compute",
+    };
+    return (stage >= 0 && stage < STAGE_NUM) ? names[stage] : "unknown";
+}
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline double gbps(uint64_t bytes, uint64_t ns)
+{
+    return ns ? (double)bytes / ns : 0;
+}
+
+// Collects wall time, bytes moved and optionally hardware counters per
+// stage for one layer (one subcommand) at a time, and records every
+// stage as a trace span when --trace is given. Everything is behind
+// enabled(), so a run without any of them never reads the clock.
+class profiler: private noncopyable {
+public:
+    struct counter {
+        uint64_t ns = 0;
+        uint64_t bytes = 0;
+        uint64_t calls = 0;
+        uint64_t perf[PERF_NUM] = {0};
+    };
+
+    bool enabled() const { return flags_ != 0; }
+    bool perf_enabled() const { return flags_ & PROFILE_PERF; }
+    bool trace_enabled() const { return flags_ & PROFILE_TRACE; }
+    const perf_counters &perf() const { return perf_; }
+
+    bool open_trace(const std::string &filename) {
+        return trace_.open(filename, now_ns());
+    }
+
+    void begin_layer(const std::string &name, int flags) {
+        if ((flags & PROFILE_PERF) && !perf_.open()) {
+            if (!perf_warned_)
+                printf("perf counters unavailable (%s), skipped\n", perf_.error().c_str());
+            perf_warned_ = true;
+            flags &= ~PROFILE_PERF;
+        }
+
+        if (trace_.active())
+            flags |= PROFILE_TRACE;
+
+        flags_ = flags;
+        if (!enabled())
+            return;
+
+        name_ = name;
+        if (trace_enabled())
+            layer_ = trace_.add_layer(name);
+        for (int i=0; i<STAGE_NUM; i++)
+            stages_[i] = counter();
+        in_elems_ = out_elems_ = 0;
+        start_ = now_ns();
+    }
+
+    void end_layer() {
+        if (!enabled())
+            return;
+
+        uint64_t wall = now_ns() - start_;
+        uint64_t bytes = 0;
+
+        for (int i=0; i<STAGE_NUM; i++)
+            bytes += stages_[i].bytes;
+
+        if (flags_ & PROFILE_STATS) {
+            report_stats(wall, bytes);
+            run_.ns += wall;
+            run_.bytes += bytes;
+            run_.calls++;
+        }
+        if (flags_ & PROFILE_PERF)
+            report_perf();
+        if (flags_ & PROFILE_TRACE)
+            trace_.add("layer", layer_, start_, start_ + wall);
+
+        flags_ = 0;
+    }
+
+    bool end_run() {
+        if (run_.calls > 1) {
+            printf("run stats: %llu layers\n", (unsigned long long)run_.calls);
+            print_line("total", run_.ns, run_.bytes);
+        }
+
+        return !trace_.active() || trace_.save();
+    }
+
+    void add_span(int stage, uint64_t begin, uint64_t end) {
+        trace_.add(stage_name(stage), layer_, begin, end);
+    }
+
+    void add(int stage, uint64_t ns, uint64_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        counter &c = stages_[stage];
+        c.ns += ns;
+        c.bytes += bytes;
+        c.calls++;
+    }
+
+    void add_perf(int stage, const perf_counters::sample &begin,
+            const perf_counters::sample &end) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        counter &c = stages_[stage];
+        for (int i=0; i<PERF_NUM; i++)
+            c.perf[i] += end.v[i] - begin.v[i];
+    }
+
+    void set_elements(uint64_t in, uint64_t out) {
+        if (!enabled())
+            return;
+        in_elems_ = in;
+        out_elems_ = out;
+    }
+
+private:
+    void report_stats(uint64_t wall, uint64_t bytes) {
+        printf("%s stats:\n", name_.c_str());
+        printf("  %-10s %12s %14s %9s\n", "stage", "time(ms)", "bytes", "GB/s");
+        for (int i=0; i<STAGE_NUM; i++) {
+            const counter &c = stages_[i];
+            if (c.calls)
+                print_line(stage_name(i), c.ns, c.bytes);
+        }
+        print_line("total", wall, bytes);
+
+        if (in_elems_)
+            printf("  blow-up %.3f (%llu -> %llu elements)\n",
+                    (double)out_elems_ / in_elems_,
+                    (unsigned long long)in_elems_, (unsigned long long)out_elems_);
+    }
+
+    void report_perf() {
+        printf("%s perf counters:\n", name_.c_str());
+        printf("  %-10s", "stage");
+        for (int i=0; i<PERF_NUM; i++)
+            printf(" %14s", perf_counter_name(i));
+        printf(" %6s\n", "IPC");
+
+        for (int i=0; i<STAGE_NUM; i++) {
+            const counter &c = stages_[i];
+            if (!c.calls)
+                continue;
+
+            printf("  %-10s", stage_name(i));
+            for (int j=0; j<PERF_NUM; j++) {
+                if (perf_.valid(j))
+                    printf(" %14llu", (unsigned long long)c.perf[j]);
+                else
+                    printf(" %14s", "n/a");
+            }
+
+            if (perf_.valid(PERF_CYCLES) && perf_.valid(PERF_INSTRUCTIONS) && c.perf[PERF_CYCLES])
+                printf(" %6.2f\n", (double)c.perf[PERF_INSTRUCTIONS] / c.perf[PERF_CYCLES]);
+            else
+                printf(" %6s\n", "n/a");
+        }
+    }
+
+    static void print_line(const char *name, uint64_t ns, uint64_t bytes) {
+        printf("  %-10s %12.3f %14llu %9.3f\n", name, ns / 1e6,
+                (unsigned long long)bytes, gbps(bytes, ns));
+    }
+
+private:
+    int flags_ = 0;
+    bool perf_warned_ = false;
+    perf_counters perf_;
+    trace_writer trace_;
+    int layer_ = -1;
+    std::string name_;
+    std::mutex mutex_;
+    counter stages_[STAGE_NUM];
+    counter run_;
+    uint64_t in_elems_ = 0;
+    uint64_t out_elems_ = 0;
+    uint64_t start_ = 0;
+};
+
+static profiler &prof()
+{
+    static profiler p;
+    return p;
+}
+
+// Times the enclosing block as one stage of the current layer.
+class stage_scope: private noncopyable {
+public:
+    stage_scope(int stage, uint64_t bytes = 0): stage_(stage), bytes_(bytes) {
+        if (!prof().enabled())
+            return;
+        if (prof().perf_enabled())
+            prof().perf().read(perf_);
+        start_ = now_ns();
+    }
+
+    ~stage_scope() {
+        if (!prof().enabled())
+            return;
+        uint64_t end = now_ns();
+        prof().add(stage_, end - start_, bytes_);
+        if (prof().trace_enabled())
+            prof().add_span(stage_, start_, end);
+        if (prof().perf_enabled()) {
+            perf_counters::sample end;
+            prof().perf().read(end);
+            prof().add_perf(stage_, perf_, end);
+        }
+    }
+
+    void set_bytes(uint64_t bytes) { bytes_ = bytes; }
+
+private:
+    int stage_;
+    uint64_t bytes_;
+    uint64_t start_ = 0;
+    perf_counters::sample perf_;
+};
+
+// Records the enclosing block as a trace span only, for work that is
+// already accounted for by an outer stage_scope (e.g. worker threads).
+class trace_scope: private noncopyable {
+public:
+    trace_scope(int stage): stage_(stage) {
+        if (prof().trace_enabled())
+            start_ = now_ns();
+    }
+
+    ~trace_scope() {
+        if (prof().trace_enabled())
+            prof().add_span(stage_, start_, now_ns());
+    }
+
+private:
+    int stage_;
+    uint64_t start_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,95 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: random.h
+ *     Created: 2018-05-09 10:40
+ * Description: seeded random streams with random access
+ * ===================================================
+ */
+#ifndef _KX_RANDOM_H
+#define _KX_RANDOM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+#define RAND_LANES 4
+#define RAND_BLOCK 1024
+
+namespace kx {
+
+static inline uint64_t splitmix64(uint64_t &x)
+{
+    uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// A stream of 64 bit values split into blocks of RAND_BLOCK. Each block
+// runs RAND_LANES xoshiro256** generators side by side (so the compiler
+// can keep the lanes in vector registers), seeded from the block number
+// by splitmix64. Value i therefore only depends on the seed and i, and
+// any range can be filled by any thread in any order.
+class rand_stream {
+public:
+    explicit rand_stream(uint64_t seed = 0): seed_(seed) {}
+
+    void fill(uint64_t *out, size_t begin, size_t n) const {
+        uint64_t buf[RAND_BLOCK];
+
+        while (n) {
+            size_t skip = begin % RAND_BLOCK;
+            size_t count = std::min(n, (size_t)RAND_BLOCK - skip);
+
+            if (count == RAND_BLOCK) {
+                generate(begin / RAND_BLOCK, out);
+            } else {
+                generate(begin / RAND_BLOCK, buf);
+                memcpy(out, buf + skip, count * sizeof(uint64_t));
+            }
+
+            out += count;
+            begin += count;
+            n -= count;
+        }
+    }
+
+private:
+    void generate(uint64_t block, uint64_t *out) const {
+        uint64_t s0[RAND_LANES], s1[RAND_LANES], s2[RAND_LANES], s3[RAND_LANES];
+        uint64_t x = seed_ + block * 4 * RAND_LANES * 0x9e3779b97f4a7c15ull;
+
+        for (int l=0; l<RAND_LANES; l++) {
+            s0[l] = splitmix64(x);
+            s1[l] = splitmix64(x);
+            s2[l] = splitmix64(x);
+            s3[l] = splitmix64(x);
+        }
+
+        for (int i=0; i<RAND_BLOCK; i+=RAND_LANES) {
+            for (int l=0; l<RAND_LANES; l++) {
+                out[i+l] = rotl(s1[l] * 5, 7) * 9;
+                uint64_t t = s1[l] << 17;
+                s2[l] ^= s0[l];
+                s3[l] ^= s1[l];
+                s1[l] ^= s2[l];
+                s0[l] ^= s3[l];
+                s2[l] ^= t;
+                s3[l] = rotl(s3[l], 45);
+            }
+        }
+    }
+
+private:
+    uint64_t seed_;
+};
+
+}
+
+#endif
@@ -0,0 +1,541 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: reference.h
+ *     Created: 2018-05-14 15:36
+ * Description: cpu reference of the layers the fpga computes
+ * ===================================================
+ */
+#ifndef _KX_REFERENCE_H
+#define _KX_REFERENCE_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+#include "CLI11.hpp"
+#include "gemm.h"
+#include "layout.h"
+
+// output pixels computed per task, the im2col block of a task is
+// CONV_NB * inputs * dim * dim numbers
+#define CONV_NB 16
+
+// lanes of the fixed point kernels, each lane is one output pixel (or
+// one batch entry for fc) accumulated in input order
+#define FIXED_NB 64
+
+enum round_t {
+    ROUND_FLOOR,
+    ROUND_TRUNC,
+    ROUND_NEAREST,
+    ROUND_EVEN,
+};
+
+// kernels of the accumulator lanes, each wider one also running the
+// lanes left over by it
+enum lanes_t {
+    LANES_SCALAR,
+    LANES_SSE2,
+    LANES_AVX2,
+};
+
+// Arithmetic of the fpga MAC array: operands are the low data_bits of
+// each uint32 word, signed, with frac_bits fraction bits. Products are
+// summed into an acc_bits accumulator preloaded with the bias (aligned
+// to the 2*frac_bits of a product), which either wraps or saturates on
+// every add. The sum is shifted back by frac_bits with the given
+// rounding and wrapped or saturated to out_bits, stored sign extended.
+struct fixed_point {
+    int data_bits = 16;
+    int frac_bits = 8;
+    int acc_bits = 48;
+    int out_bits = 16;
+    int round = ROUND_NEAREST;
+    bool acc_saturate = false;
+    bool out_saturate = true;
+    int lanes = LANES_SCALAR;
+
+    void add_options(CLI::App *sub) {
+        sub->add_option("--data-bits", data_bits, "bits of an operand", true);
+        sub->add_option("--frac-bits", frac_bits, "fraction bits of operands and outputs", true);
+        sub->add_option("--acc-bits", acc_bits, "bits of the accumulator", true);
+        sub->add_option("--out-bits", out_bits, "bits of an output", true);
+        sub->add_set("--round", round_name, {"floor", "trunc", "nearest", "even"}, "rounding of outputs", true);
+        sub->add_set("--acc-overflow", acc_overflow, {"wrap", "saturate"}, "accumulator overflow", true);
+        sub->add_set("--out-overflow", out_overflow, {"wrap", "saturate"}, "output overflow", true);
+        sub->add_set("--lanes", lanes_name, {"auto", "avx2", "sse2", "scalar"},
+                "kernel of the accumulator lanes, auto for the widest the cpu has", true);
+    }
+
+    // call after parsing, false if the widths can not be emulated or the
+    // cpu has not the lanes asked for
+    bool init() {
+        static const char *rounds[] = {"floor", "trunc", "nearest", "even"};
+        for (int i=0; i<4; i++) {
+            if (round_name == rounds[i])
+                round = i;
+        }
+        acc_saturate = acc_overflow == "saturate";
+        out_saturate = out_overflow == "saturate";
+
+        // a saturating add of a 2*data_bits product must not overflow int64
+        int acc_max = acc_saturate ? 62 : 64;
+        if (!(data_bits > 0 && data_bits <= 32 && frac_bits >= 0 && frac_bits < data_bits &&
+                acc_bits > 1 && acc_bits <= acc_max && out_bits > 0 && out_bits <= 32)) {
+            printf("unsupported fixed point widths\n");
+            return false;
+        }
+
+        static const char *kernels[] = {"scalar", "sse2", "avx2"};
+        int widest = cpu_lanes();
+        lanes = widest;
+        for (int i=0; i<3; i++) {
+            if (lanes_name == kernels[i])
+                lanes = i;
+        }
+        if (lanes > widest) {
+            printf("the cpu can not run %s lanes\n", lanes_name.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    static int cpu_lanes() {
+#ifdef __SSE2__
+        return __builtin_cpu_supports("avx2") ? LANES_AVX2 : LANES_SSE2;
+#else
+        return LANES_SCALAR;
+#endif
+    }
+
+    int32_t operand(uint32_t v) const {
+        return (int32_t)(v << (32 - data_bits)) >> (32 - data_bits);
+    }
+
+    int64_t bias(uint32_t v) const {
+        return (int64_t)operand(v) * ((int64_t)1 << frac_bits);
+    }
+
+    int64_t acc_min() const { return -((int64_t)1 << (acc_bits - 1)); }
+    int64_t acc_max() const { return ((int64_t)1 << (acc_bits - 1)) - 1; }
+
+    uint32_t output(int64_t acc) const {
+        int64_t v = shift(wrap(acc, acc_bits));
+        if (out_saturate) {
+            int64_t hi = ((int64_t)1 << (out_bits - 1)) - 1;
+            v = std::min(std::max(v, -hi - 1), hi);
+        } else {
+            v = wrap(v, out_bits);
+        }
+        return (uint32_t)(int32_t)v;
+    }
+
+    static int64_t wrap(int64_t v, int bits) {
+        if (bits >= 64)
+            return v;
+        return (int64_t)((uint64_t)v << (64 - bits)) >> (64 - bits);
+    }
+
+    int64_t shift(int64_t v) const {
+        if (frac_bits == 0)
+            return v;
+
+        int64_t half = (int64_t)1 << (frac_bits - 1);
+        int64_t q = v >> frac_bits;
+        int64_t r = v - q * ((int64_t)1 << frac_bits);
+
+        switch (round) {
+        case ROUND_TRUNC:   return (q < 0 && r) ? q + 1 : q;
+        case ROUND_NEAREST: return r >= half ? q + 1 : q;
+        case ROUND_EVEN:    return (r > half || (r == half && (q & 1))) ? q + 1 : q;
+        default:            return q;
+        }
+    }
+
+    std::string round_name = "nearest";
+    std::string acc_overflow = "wrap";
+    std::string out_overflow = "saturate";
+    std::string lanes_name = "auto";
+};
+
+#ifdef __SSE2__
+// every 64 bit lane all ones where it is negative
+static inline __m128i sign64(__m128i v)
+{
+    return _mm_shuffle_epi32(_mm_srai_epi32(v, 31), _MM_SHUFFLE(3, 3, 1, 1));
+}
+
+// acc[0, 2*R) += a[kk] * b[kk][0, 2*R) for kk < k, two int64 lanes a
+// register. SSE2 has only the unsigned 32x32 multiply, the signed product
+// is that minus the cross terms of the sign extensions. Saturating sums
+// stay below 2^63, so the sign of hi - v and v - lo compares them.
+template<int R, bool SATURATE>
+static void fixed_lanes_sse2(const int32_t *a, const int32_t *b, int ldb, int k,
+        int64_t lo, int64_t hi, int64_t *acc)
+{
+    const __m128i vlo = _mm_set1_epi64x(lo);
+    const __m128i vhi = _mm_set1_epi64x(hi);
+    __m128i s[R];
+    for (int r=0; r<R; r++)
+        s[r] = _mm_loadu_si128((const __m128i *)(acc + 2*r));
+
+    for (int kk=0; kk<k; kk++) {
+        const int32_t *pb = b + (size_t)kk*ldb;
+        __m128i w = _mm_set1_epi64x((uint32_t)a[kk]);
+        __m128i wneg = _mm_set1_epi64x(a[kk] < 0 ? -1 : 0);
+        for (int r=0; r<R; r++) {
+            __m128i x = _mm_loadl_epi64((const __m128i *)(pb + 2*r));
+            __m128i v = _mm_unpacklo_epi32(x, _mm_srai_epi32(x, 31));
+            __m128i cross = _mm_add_epi64(_mm_and_si128(wneg, v), _mm_and_si128(sign64(v), w));
+            __m128i p = _mm_sub_epi64(_mm_mul_epu32(w, v), _mm_slli_epi64(cross, 32));
+
+            v = _mm_add_epi64(s[r], p);
+            if (SATURATE) {
+                __m128i over = sign64(_mm_sub_epi64(vhi, v));
+                v = _mm_or_si128(_mm_and_si128(over, vhi), _mm_andnot_si128(over, v));
+                __m128i under = sign64(_mm_sub_epi64(v, vlo));
+                v = _mm_or_si128(_mm_and_si128(under, vlo), _mm_andnot_si128(under, v));
+            }
+            s[r] = v;
+        }
+    }
+
+    for (int r=0; r<R; r++)
+        _mm_storeu_si128((__m128i *)(acc + 2*r), s[r]);
+}
+
+// as fixed_lanes_sse2, four lanes a register with the signed multiply
+// and 64 bit compares of avx2
+template<int R, bool SATURATE>
+__attribute__((target("avx2")))
+static void fixed_lanes_avx2(const int32_t *a, const int32_t *b, int ldb, int k,
+        int64_t lo, int64_t hi, int64_t *acc)
+{
+    const __m256i vlo = _mm256_set1_epi64x(lo);
+    const __m256i vhi = _mm256_set1_epi64x(hi);
+    __m256i s[R];
+    for (int r=0; r<R; r++)
+        s[r] = _mm256_loadu_si256((const __m256i *)(acc + 4*r));
+
+    for (int kk=0; kk<k; kk++) {
+        const int32_t *pb = b + (size_t)kk*ldb;
+        __m256i w = _mm256_set1_epi64x(a[kk]);
+        for (int r=0; r<R; r++) {
+            __m256i v = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(pb + 4*r)));
+            v = _mm256_add_epi64(s[r], _mm256_mul_epi32(w, v));
+            if (SATURATE) {
+                v = _mm256_blendv_epi8(v, vhi, _mm256_cmpgt_epi64(v, vhi));
+                v = _mm256_blendv_epi8(v, vlo, _mm256_cmpgt_epi64(vlo, v));
+            }
+            s[r] = v;
+        }
+    }
+
+    for (int r=0; r<R; r++)
+        _mm256_storeu_si256((__m256i *)(acc + 4*r), s[r]);
+}
+#endif
+
+// acc[j] += a[kk] * b[kk][j] for kk < k and j < n, every lane in k
+// order, wrapping in 64 bits or saturating to [lo, hi]. The lanes are
+// independent, so they go four registers at a time through the kernel of
+// lanes (see lanes_t), then the narrower ones, and the last odd lane is
+// scalar.
+template<bool SATURATE>
+static void fixed_lanes(int lanes, const int32_t *a, const int32_t *b, int ldb, int k, int n,
+        int64_t lo, int64_t hi, int64_t *acc)
+{
+    int j = 0;
+#ifdef __SSE2__
+    if (lanes >= LANES_AVX2) {
+        for (; j+16<=n; j+=16)
+            fixed_lanes_avx2<4, SATURATE>(a, b + j, ldb, k, lo, hi, acc + j);
+        for (; j+4<=n; j+=4)
+            fixed_lanes_avx2<1, SATURATE>(a, b + j, ldb, k, lo, hi, acc + j);
+    }
+    if (lanes >= LANES_SSE2) {
+        for (; j+8<=n; j+=8)
+            fixed_lanes_sse2<4, SATURATE>(a, b + j, ldb, k, lo, hi, acc + j);
+        for (; j+2<=n; j+=2)
+            fixed_lanes_sse2<1, SATURATE>(a, b + j, ldb, k, lo, hi, acc + j);
+    }
+#endif
+    for (; j<n; j++) {
+        for (int kk=0; kk<k; kk++) {
+            int64_t p = (int64_t)a[kk] * b[(size_t)kk*ldb + j];
+            if (SATURATE)
+                acc[j] = std::min(std::max(acc[j] + p, lo), hi);
+            else
+                acc[j] = (int64_t)((uint64_t)acc[j] + (uint64_t)p);
+        }
+    }
+}
+
+// c[i*c_rs + j*c_cs] = bias[i] + a[i][k] . b[k][j] for n <= FIXED_NB
+// lanes. Every lane sums its products in k order, so a saturating
+// accumulator gives the same result as the sequential MAC; wrapping sums
+// are order free and wrap to acc_bits once in output().
+static void gemm_fixed(const fixed_point &fx, int m, int n, int k,
+        const int32_t *a, const int32_t *b, int ldb, const int64_t *bias,
+        uint32_t *c, int c_rs, int c_cs)
+{
+    int64_t acc[FIXED_NB];
+    int64_t lo = fx.acc_min();
+    int64_t hi = fx.acc_max();
+
+    for (int i=0; i<m; i++) {
+        const int32_t *pa = a + (size_t)i*k;
+        for (int j=0; j<n; j++)
+            acc[j] = bias ? bias[i] : 0;
+
+        if (fx.acc_saturate)
+            fixed_lanes<true>(fx.lanes, pa, b, ldb, k, n, lo, hi, acc);
+        else
+            fixed_lanes<false>(fx.lanes, pa, b, ldb, k, n, lo, hi, acc);
+
+        for (int j=0; j<n; j++)
+            c[(size_t)i*c_rs + (size_t)j*c_cs] = fx.output(acc[j]);
+    }
+}
+
+template<class T>
+static std::vector<T> decode_operands(const fixed_point &fx, const uint32_t *src, size_t n)
+{
+    std::vector<T> dst(n);
+    for (size_t i=0; i<n; i++)
+        dst[i] = fx.operand(src[i]);
+    return dst;
+}
+
+static std::vector<int64_t> decode_bias(const fixed_point &fx, const uint32_t *src, size_t n)
+{
+    std::vector<int64_t> dst(n, 0);
+    for (size_t i=0; src && i<n; i++)
+        dst[i] = fx.bias(src[i]);
+    return dst;
+}
+
+// Convolution over the source layouts the formatters consume:
+// weight[output][input][ky][kx], bias[output] and
+// img[batch][input][y][x], giving out[batch][output][y][x]. same_conv
+// pads like feature_maps, (dim-1)/2 zeros on every side.
+class conv_ref {
+public:
+    conv_ref(int dim, int inputs, int outputs, int img_h, bool same_conv):
+        dim_(dim), inputs_(inputs), outputs_(outputs), img_h_(img_h),
+        pad_(same_conv ? (dim - 1)/2 : 0) {}
+
+    int out_h() { return img_h_ + 2*pad_ - dim_ + 1; }
+    int out_pixels() { return out_h() * out_h(); }
+    int k() { return inputs_ * dim_ * dim_; }
+
+    size_t weight_size() { return (size_t)outputs_ * k(); }
+    size_t img_size() { return (size_t)inputs_ * img_h_ * img_h_; }
+    size_t out_size() { return (size_t)outputs_ * out_pixels(); }
+
+    void run(const float *weight, const float *bias, const float *img, float *out, int batch) {
+        int blocks = (out_pixels() + CONV_NB - 1) / CONV_NB;
+
+        parallel_for(STAGE_COMPUTE, (size_t)batch * blocks, 1, [&](size_t begin, size_t end) {
+            std::vector<float> col(CONV_NB * k());
+            for (size_t t=begin; t<end; t++) {
+                int b = t / blocks;
+                int p0 = (t % blocks) * CONV_NB;
+                int n = std::min(CONV_NB, out_pixels() - p0);
+                float *o = out + b*out_size() + p0;
+
+                im2col(img + b*img_size(), p0, n, &col[0]);
+                for (int oc=0; oc<outputs_; oc++)
+                    std::fill(o + oc*out_pixels(), o + oc*out_pixels() + n, bias ? bias[oc] : 0);
+                sgemm_nt(outputs_, n, k(), weight, k(), &col[0], k(), o, out_pixels());
+            }
+        });
+    }
+
+    // Fixed point version of run() over uint32 words, see fixed_point.
+    void run_fixed(const fixed_point &fx, const uint32_t *weight, const uint32_t *bias,
+            const uint32_t *img, uint32_t *out, int batch) {
+        std::vector<int32_t> w = decode_operands<int32_t>(fx, weight, weight_size());
+        std::vector<int32_t> x = decode_operands<int32_t>(fx, img, img_size() * batch);
+        std::vector<int64_t> b = decode_bias(fx, bias, outputs_);
+        int blocks = (out_pixels() + FIXED_NB - 1) / FIXED_NB;
+
+        parallel_for(STAGE_COMPUTE, (size_t)batch * blocks, 1, [&](size_t begin, size_t end) {
+            std::vector<int32_t> col((size_t)FIXED_NB * k());
+            for (size_t t=begin; t<end; t++) {
+                int bi = t / blocks;
+                int p0 = (t % blocks) * FIXED_NB;
+                int n = std::min(FIXED_NB, out_pixels() - p0);
+
+                im2col_t(&x[bi*img_size()], p0, n, &col[0]);
+                gemm_fixed(fx, outputs_, n, k(), &w[0], &col[0], n, &b[0],
+                        out + bi*out_size() + p0, out_pixels(), 1);
+            }
+        });
+    }
+
+    // col[input][ky][kx][j], the transpose of im2col
+    template<class T>
+    void im2col_t(const T *img, int p0, int n, T *col) {
+        for (int c=0; c<inputs_; c++) {
+            const T *plane = img + (size_t)c * img_h_ * img_h_;
+            for (int ky=0; ky<dim_; ky++) {
+                for (int kx=0; kx<dim_; kx++) {
+                    for (int j=0; j<n; j++) {
+                        int y = (p0 + j) / out_h() - pad_ + ky;
+                        int x = (p0 + j) % out_h() - pad_ + kx;
+                        bool in = y >= 0 && y < img_h_ && x >= 0 && x < img_h_;
+                        *col++ = in ? plane[y*img_h_ + x] : 0;
+                    }
+                }
+            }
+        }
+    }
+
+    // col[j][input][ky][kx] for the output pixels p0 .. p0+n
+    template<class T>
+    void im2col(const T *img, int p0, int n, T *col) {
+        for (int j=0; j<n; j++) {
+            int oy = (p0 + j) / out_h() - pad_;
+            int ox = (p0 + j) % out_h() - pad_;
+
+            for (int c=0; c<inputs_; c++) {
+                const T *plane = img + (size_t)c * img_h_ * img_h_;
+                for (int ky=0; ky<dim_; ky++) {
+                    int y = oy + ky;
+                    for (int kx=0; kx<dim_; kx++) {
+                        int x = ox + kx;
+                        bool in = y >= 0 && y < img_h_ && x >= 0 && x < img_h_;
+                        *col++ = in ? plane[y*img_h_ + x] : 0;
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    int dim_;
+    int inputs_;
+    int outputs_;
+    int img_h_;
+    int pad_;
+};
+
+// Fully connected layer over host order weight[output][input], bias[output]
+// and x[batch][input], giving out[batch][output].
+class fc_ref {
+public:
+    fc_ref(int inputs, int outputs): inputs_(inputs), outputs_(outputs) {}
+
+    size_t weight_size() { return (size_t)outputs_ * inputs_; }
+
+    void run_fixed(const fixed_point &fx, const uint32_t *weight, const uint32_t *bias,
+            const uint32_t *x, uint32_t *out, int batch) {
+        std::vector<int32_t> w = decode_operands<int32_t>(fx, weight, weight_size());
+        std::vector<int64_t> b = decode_bias(fx, bias, outputs_);
+        const int rows = 16;
+        int row_blocks = (outputs_ + rows - 1) / rows;
+        int blocks = (batch + FIXED_NB - 1) / FIXED_NB;
+
+        parallel_for(STAGE_COMPUTE, (size_t)blocks * row_blocks, 1, [&](size_t begin, size_t end) {
+            std::vector<int32_t> xt((size_t)inputs_ * FIXED_NB);
+            for (size_t t=begin; t<end; t++) {
+                int b0 = (t / row_blocks) * FIXED_NB;
+                int r0 = (t % row_blocks) * rows;
+                int n = std::min(FIXED_NB, batch - b0);
+                int m = std::min(rows, outputs_ - r0);
+
+                // xt[input][j], batch entries become the lanes
+                for (int i=0; i<inputs_; i++) {
+                    for (int j=0; j<n; j++)
+                        xt[i*n + j] = fx.operand(x[(size_t)(b0 + j)*inputs_ + i]);
+                }
+
+                gemm_fixed(fx, m, n, inputs_, &w[(size_t)r0*inputs_], &xt[0], n, &b[r0],
+                        out + (size_t)b0*outputs_ + r0, 1, outputs_);
+            }
+        });
+    }
+
+private:
+    int inputs_;
+    int outputs_;
+};
+
+// Fully connected layer, optionally followed by batch norm, computed
+// straight from the formatted blobs: weight in fc_fcw, bias in fc_bias
+// and the bn scale/shift in bn_fc. x[batch][inputs] gives
+// out[batch][outputs].
+class fc_layout_ref {
+public:
+    fc_layout_ref(int inputs, int outputs):
+        inputs_(inputs), outputs_(outputs), fcw_(inputs, outputs), bias_(outputs), bn_(outputs) {}
+
+    fc_fcw &weight_layout() { return fcw_; }
+    fc_bias &bias_layout() { return bias_; }
+    bn_fc &bn_layout() { return bn_; }
+
+    // Cells of fc_fcw are rows of the weight matrix cell_size() apart, so
+    // the blob is the b operand of sgemm_nt as is; its padding is never read.
+    void run(const float *weight, const float *bias, const float *bn,
+            const float *x, float *out, int batch) {
+        const int rows = 4;
+        const int cols = 64;
+        int row_blocks = (batch + rows - 1) / rows;
+        int col_blocks = (outputs_ + cols - 1) / cols;
+        int ldw = fcw_.get_cell_addr(1) - fcw_.get_cell_addr(0);
+
+        parallel_for(STAGE_COMPUTE, (size_t)row_blocks * col_blocks, 1, [&](size_t begin, size_t end) {
+            for (size_t t=begin; t<end; t++) {
+                int r0 = (t / col_blocks) * rows;
+                int c0 = (t % col_blocks) * cols;
+                int m = std::min(rows, batch - r0);
+                int n = std::min(cols, outputs_ - c0);
+                float *o = out + (size_t)r0*outputs_ + c0;
+
+                for (int i=0; i<m; i++) {
+                    for (int j=0; j<n; j++)
+                        o[i*outputs_ + j] = bias ? bias[bias_.get_bias_addr(c0 + j)] : 0;
+                }
+                sgemm_nt(m, n, inputs_, x + (size_t)r0*inputs_, inputs_,
+                        weight + fcw_.get_cell_addr(c0), ldw, o, outputs_);
+
+                if (!bn)
+                    continue;
+                for (int i=0; i<m; i++) {
+                    for (int j=0; j<n; j++) {
+                        float &v = o[i*outputs_ + j];
+                        v = v * bn[bn_.get_weight_addr(c0 + j)] + bn[bn_.get_bias_addr(c0 + j)];
+                    }
+                }
+            }
+        });
+    }
+
+private:
+    int inputs_;
+    int outputs_;
+    fc_fcw fcw_;
+    fc_bias bias_;
+    bn_fc bn_;
+};
+
+// The formats zero every word locate() calls padding; a nonzero one means
+// the blob was not produced for this shape. Returns the first such
+// address, or -1.
+template<class L, class F>
+static int nonzero_padding(L &l, const F *blob)
+{
+    int coord[LAYOUT_COORDS];
+    for (int addr=0; addr<l.size(); addr++) {
+        if (blob[addr] != 0 && !l.locate(addr, coord))
+            return addr;
+    }
+    return -1;
+}
+
+#endif
@@ -0,0 +1,259 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: simd.h
+ *     Created: 2018-05-07 15:02
+ * Description: vectorized helpers for scanning large blobs
+ * ===================================================
+ */
+#ifndef _KX_SIMD_H
+#define _KX_SIMD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif
+
+namespace kx {
+
+// Returns the offset of the first differing byte of a and b, or n when
+// they are equal. Equal 64 byte blocks cost four compares and one
+// movemask, so equal regions are skipped at memory bandwidth.
+static inline size_t mismatch(const void *a, const void *b, size_t n)
+{
+    const uint8_t *pa = (const uint8_t *)a;
+    const uint8_t *pb = (const uint8_t *)b;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 64 <= n; i += 64) {
+        __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pa + i)),
+                _mm_loadu_si128((const __m128i *)(pb + i)));
+        __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pa + i + 16)),
+                _mm_loadu_si128((const __m128i *)(pb + i + 16)));
+        __m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pa + i + 32)),
+                _mm_loadu_si128((const __m128i *)(pb + i + 32)));
+        __m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pa + i + 48)),
+                _mm_loadu_si128((const __m128i *)(pb + i + 48)));
+        __m128i e = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+        if (_mm_movemask_epi8(e) != 0xffff)
+            break;
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (pa[i] != pb[i])
+            return i;
+    }
+    return n;
+}
+
+// Calls found(pos) for every pos in [0, n) that is a multiple of align
+// (1, 2, 4 or 8) and where the m > 0 bytes of pat occur at p + pos, in
+// increasing order. p must be readable up to n + m - 1. Sixteen
+// positions are filtered at once by comparing the first and the last
+// byte of pat, and only the candidates left are checked with memcmp.
+template<class F>
+static inline void search(const void *p, size_t n, const void *pat, size_t m, size_t align, F found)
+{
+    const uint8_t *s = (const uint8_t *)p;
+    const uint8_t *t = (const uint8_t *)pat;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    static const int align_masks[9] = {0, 0xffff, 0x5555, 0, 0x1111, 0, 0, 0, 0x0101};
+    const int keep = align_masks[align];
+    const __m128i first = _mm_set1_epi8(t[0]);
+    const __m128i last = _mm_set1_epi8(t[m - 1]);
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i)), first);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i + m - 1)), last);
+        int mask = _mm_movemask_epi8(_mm_and_si128(a, b)) & keep;
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (memcmp(s + pos, t, m) == 0)
+                found(pos);
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i < n; i += align) {
+        if (s[i] == t[0] && memcmp(s + i, t, m) == 0)
+            found(i);
+    }
+}
+
+#ifdef __SSE2__
+// Reverses the bytes inside every n byte lane of v, n is 1, 2, 4, 8 or 16.
+static inline __m128i reverse_lanes(__m128i v, int n)
+{
+    if (n >= 2)
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    if (n >= 4)
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2,3,0,1)), _MM_SHUFFLE(2,3,0,1));
+    if (n >= 8)
+        v = _mm_shuffle_epi32(v, _MM_SHUFFLE(2,3,0,1));
+    if (n >= 16)
+        v = _mm_shuffle_epi32(v, _MM_SHUFFLE(1,0,3,2));
+    return v;
+}
+
+// Writes the 32 lowercase hex digits of the bytes of v, in memory order.
+static inline void hex_encode(__m128i v, char *out)
+{
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+    __m128i lo = _mm_and_si128(v, mask);
+
+    // '0' + d, plus 'a' - '0' - 10 for d > 9
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i gap = _mm_set1_epi8('a' - '0' - 10);
+    hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), gap));
+    lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), gap));
+
+    _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi8(hi, lo));
+}
+
+// Turns 16 hex digits of either case into the 8 bytes they spell, in the
+// low half of the result, the first digit being the high nibble of the
+// first byte. *bad gets the movemask bit of every char that is not a hex
+// digit.
+static inline __m128i hex_decode(__m128i text, int *bad)
+{
+    __m128i lower = _mm_or_si128(text, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(text, _mm_set1_epi8('0' - 1)),
+            _mm_cmplt_epi8(text, _mm_set1_epi8('9' + 1)));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+            _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    *bad = ~_mm_movemask_epi8(_mm_or_si128(digit, alpha)) & 0xffff;
+
+    // digits are their own lower case
+    __m128i v = _mm_sub_epi8(_mm_sub_epi8(lower, _mm_set1_epi8('0')),
+            _mm_and_si128(alpha, _mm_set1_epi8('a' - '0' - 10)));
+    __m128i pairs = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(v, 4), _mm_set1_epi16(0xf0)),
+            _mm_srli_epi16(v, 8));
+    return _mm_packus_epi16(pairs, _mm_setzero_si128());
+}
+#endif
+
+
+// The byte of a stride that ends up at b when the numbers of width bytes
+// are byte swapped (swap) and put in reverse order (reverse).
+static inline size_t convert_source(size_t b, size_t stride, int width, bool swap, bool reverse)
+{
+    size_t j = b / width;
+    size_t k = b % width;
+    if (reverse)
+        j = stride / width - 1 - j;
+    if (swap)
+        k = width - 1 - k;
+    return j * width + k;
+}
+
+// A byte permutation of 16 byte blocks: byte i of a result block is byte
+// control[i] of the source block, which is also
+// reverse_lanes(reverse_lanes(v, first), second) for cpus without ssse3.
+struct block_shuffle {
+    uint8_t control[16];
+    int first;
+    int second;
+};
+
+#ifdef __SSE2__
+__attribute__((target("ssse3")))
+static void shuffle_blocks_ssse3(char *dst, const char *src, size_t blocks, ptrdiff_t step,
+        const block_shuffle &s)
+{
+    __m128i control = _mm_loadu_si128((const __m128i *)s.control);
+    for (size_t i=0; i<blocks; i++, src += step) {
+        __m128i v = _mm_loadu_si128((const __m128i *)src);
+        _mm_storeu_si128((__m128i *)(dst + 16*i), _mm_shuffle_epi8(v, control));
+    }
+}
+
+static void shuffle_blocks_sse2(char *dst, const char *src, size_t blocks, ptrdiff_t step,
+        const block_shuffle &s)
+{
+    for (size_t i=0; i<blocks; i++, src += step) {
+        __m128i v = _mm_loadu_si128((const __m128i *)src);
+        v = reverse_lanes(reverse_lanes(v, s.first), s.second);
+        _mm_storeu_si128((__m128i *)(dst + 16*i), v);
+    }
+}
+#endif
+
+// Writes blocks permuted blocks to dst, taking the source blocks step
+// bytes apart from src. pshufb is used when the cpu has it.
+static inline void shuffle_blocks(char *dst, const char *src, size_t blocks, ptrdiff_t step,
+        const block_shuffle &s)
+{
+#ifdef __SSE2__
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+    if (ssse3)
+        shuffle_blocks_ssse3(dst, src, blocks, step, s);
+    else
+        shuffle_blocks_sse2(dst, src, blocks, step, s);
+#else
+    for (size_t i=0; i<blocks; i++, src += step) {
+        for (int k=0; k<16; k++)
+            dst[16*i + k] = src[s.control[k]];
+    }
+#endif
+}
+
+// Copies n bytes from src to dst with the bytes of every number of width
+// bytes reversed (swap) and the numbers of every stride of stride bytes
+// in reverse order (reverse), which is what dump shows with --be and -r.
+// n is a multiple of stride, stride of width, and width divides 16.
+// Strides that fit a block are permuted a block at a time; longer ones
+// are mirrored, each block of the result coming from the block at the
+// same distance from the other end of the stride.
+static void convert_strides(char *dst, const char *src, size_t n, size_t stride, int width,
+        bool swap, bool reverse)
+{
+    if ((!swap || width == 1) && (!reverse || stride == (size_t)width)) {
+        memcpy(dst, src, n);
+        return;
+    }
+
+    bool mirror = reverse && (stride > 16 || 16 % stride);
+    size_t group = reverse && !mirror ? stride : width;
+    block_shuffle s;
+    for (int i=0; i<16; i++) {
+        if (mirror) {
+            int k = i % width;
+            s.control[i] = 15 - (i - k + convert_source(k, width, width, !swap, false));
+        } else {
+            int k = i % group;
+            s.control[i] = i - k + convert_source(k, group, width, swap, reverse);
+        }
+    }
+    s.first = mirror ? 16 : group;
+    s.second = reverse && !swap ? width : 1;
+
+    if (!mirror) {
+        size_t blocks = n / 16;
+        shuffle_blocks(dst, src, blocks, 16, s);
+        for (size_t i=blocks*16; i<n; i++)
+            dst[i] = src[i - i % stride + convert_source(i % stride, stride, width, swap, reverse)];
+        return;
+    }
+
+    size_t blocks = stride / 16;
+    for (size_t i=0; i<n; i+=stride) {
+        if (blocks)
+            shuffle_blocks(dst + i, src + i + stride - 16, blocks, -16, s);
+        for (size_t b=blocks*16; b<stride; b++)
+            dst[i + b] = src[i + convert_source(b, stride, width, swap, reverse)];
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,91 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: trace.h
+ *     Created: 2018-05-04 11:05
+ * Description: chrome trace event (catapult/perfetto) writer
+ * ===================================================
+ */
+#ifndef _KX_TRACE_H
+#define _KX_TRACE_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "file.h"
+
+namespace kx {
+
+static inline int thread_id()
+{
+    static thread_local int tid = syscall(SYS_gettid);
+    return tid;
+}
+
+// Buffers complete ("ph":"X") events in memory and writes them as one
+// Trace Event Format json on save(), so recording a span is a lock and
+// a push_back.
+class trace_writer: private noncopyable {
+public:
+    struct event {
+        const char *name;
+        int layer;
+        int tid;
+        uint64_t ts;
+        uint64_t dur;
+    };
+
+    bool open(const std::string &filename, uint64_t origin) {
+        filename_ = filename;
+        origin_ = origin;
+        main_tid_ = thread_id();
+        return active();
+    }
+
+    bool active() const { return !filename_.empty(); }
+
+    int add_layer(const std::string &name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        layers_.push_back(name);
+        return layers_.size() - 1;
+    }
+
+    void add(const char *name, int layer, uint64_t begin, uint64_t end) {
+        event e = { name, layer, thread_id(), begin - origin_, end - begin };
+        std::lock_guard<std::mutex> lock(mutex_);
+        events_.push_back(e);
+    }
+
+    bool save() {
+        std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        out += string_format("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"model\"}},\n", getpid());
+        out += string_format("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"main\"}}", getpid(), main_tid_);
+
+        for (size_t i=0; i<events_.size(); i++) {
+            const event &e = events_[i];
+            const std::string &layer = (e.layer >= 0) ? layers_[e.layer] : empty_;
+            out += string_format(",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                    "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"layer\":%d}}",
+                    e.name, layer.c_str(), getpid(), e.tid, e.ts / 1e3, e.dur / 1e3, e.layer);
+        }
+        out += "\n]}\n";
+
+        return write_file(filename_, out.data(), out.size()) == out.size();
+    }
+
+private:
+    std::string filename_;
+    std::string empty_;
+    uint64_t origin_ = 0;
+    int main_tid_ = 0;
+    std::mutex mutex_;
+    std::vector<std::string> layers_;
+    std::vector<event> events_;
+};
+
+}
+
+#endif
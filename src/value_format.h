@@ -0,0 +1,261 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: value_format.h
+ *     Created: 2018-05-16 10:40
+ * Description: decoding and fast text formatting of typed numbers
+ * ===================================================
+ */
+#ifndef _KX_VALUE_FORMAT_H
+#define _KX_VALUE_FORMAT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <charconv>
+#include <string>
+
+// longest text of any value type, "-1.17549435e-38" and "-2147483648"
+// both fit
+#define VALUE_CHARS 16
+
+namespace kx {
+
+enum value_t {
+    VALUE_HEX,
+    VALUE_F32,
+    VALUE_F16,
+    VALUE_BF16,
+    VALUE_I8,
+    VALUE_I16,
+    VALUE_I32,
+    VALUE_U32,
+};
+
+static int value_type(const std::string &name)
+{
+    static const char *names[] = {"hex", "f32", "f16", "bf16", "i8", "i16", "i32", "u32"};
+    for (int i=0; i<8; i++) {
+        if (name == names[i])
+            return i;
+    }
+    return -1;
+}
+
+static int value_bytes(int type)
+{
+    switch (type) {
+    case VALUE_I8:   return 1;
+    case VALUE_F16:
+    case VALUE_BF16:
+    case VALUE_I16:  return 2;
+    default:         return 4;
+    }
+}
+
+static inline float bits_to_float(uint32_t x)
+{
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+static inline uint32_t float_to_bits(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    return x;
+}
+
+static inline float half_to_float(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t man = h & 0x3ff;
+
+    if (exp == 0) {
+        float f = ldexpf((float)man, -24);
+        return sign ? -f : f;
+    }
+    if (exp == 31)
+        return bits_to_float(sign | 0x7f800000 | (man << 13));
+    return bits_to_float(sign | ((exp + 112) << 23) | (man << 13));
+}
+
+// round to nearest even, like the conversion units of the fpga
+static inline uint16_t float_to_half(float f)
+{
+    uint32_t x = float_to_bits(f);
+    uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t abs = x & 0x7fffffff;
+
+    if (abs > 0x7f800000)
+        return sign | 0x7e00;
+    if (abs >= 0x477ff000)          // 65520 and up round to inf
+        return sign | 0x7c00;
+    if (abs < 0x38800000)           // subnormal, units of 2^-24
+        return sign | (uint16_t)nearbyintf(ldexpf(bits_to_float(abs), 24));
+
+    uint32_t h = (abs - 0x38000000) >> 13;
+    uint32_t rem = abs & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+        h++;
+    return sign | h;
+}
+
+static inline float bf16_to_float(uint16_t h)
+{
+    return bits_to_float((uint32_t)h << 16);
+}
+
+static inline uint16_t float_to_bf16(float f)
+{
+    uint32_t x = float_to_bits(f);
+    if ((x & 0x7fffffff) > 0x7f800000)
+        return (x >> 16) | 0x40;
+    return (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+}
+
+// the N <= 8 bytes at p as an unsigned number, little endian unless be
+template<int N>
+static inline uint64_t load_number(const char *p, bool be)
+{
+    uint8_t b[N];
+    memcpy(b, p, N);
+    uint64_t v = 0;
+    for (int i=0; i<N; i++)
+        v |= (uint64_t)b[be ? N - 1 - i : i] << (8*i);
+    return v;
+}
+
+// "00" .. "99"
+static const char *digit_pairs()
+{
+    struct table_t {
+        char v[200];
+        table_t() {
+            for (int i=0; i<100; i++) {
+                v[2*i] = '0' + i/10;
+                v[2*i + 1] = '0' + i%10;
+            }
+        }
+    };
+    static const table_t table;
+    return table.v;
+}
+
+static inline char *put_u32(char *out, uint32_t v)
+{
+    char buf[10];
+    char *p = buf + sizeof(buf);
+    const char *pairs = digit_pairs();
+
+    while (v >= 100) {
+        p -= 2;
+        memcpy(p, pairs + 2*(v % 100), 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, pairs + 2*v, 2);
+    } else {
+        *--p = '0' + v;
+    }
+
+    size_t n = buf + sizeof(buf) - p;
+    memcpy(out, p, n);
+    return out + n;
+}
+
+static inline char *put_i32(char *out, int32_t v)
+{
+    if (v < 0) {
+        *out++ = '-';
+        return put_u32(out, 0u - (uint32_t)v);
+    }
+    return put_u32(out, v);
+}
+
+// shortest text that reads back to the same float (Ryu in libstdc++)
+static inline char *put_f32(char *out, float v)
+{
+    return std::to_chars(out, out + VALUE_CHARS, v).ptr;
+}
+
+// The text of each of the 65536 values of a 16 bit type, so formatting
+// is a table lookup. For floats it is the shortest text, found by trying
+// 1, 2, ... significant digits until the text converts back to the same
+// bits.
+class value_texts {
+public:
+    struct text {
+        uint8_t len;
+        char s[VALUE_CHARS - 1];
+    };
+
+    value_texts(int type) {
+        for (uint32_t h=0; h<65536; h++) {
+            text &t = texts_[h];
+            if (type == VALUE_I16) {
+                t.len = put_i32(t.s, (int16_t)h) - t.s;
+                continue;
+            }
+
+            bool bf16 = type == VALUE_BF16;
+            float f = bf16 ? bf16_to_float(h) : half_to_float(h);
+            char *end = NULL;
+
+            for (int digits=1; !isnan(f) && !isinf(f) && digits<=9; digits++) {
+                char buf[VALUE_CHARS + 1];
+                char *e = std::to_chars(buf, buf + VALUE_CHARS, f, std::chars_format::general, digits).ptr;
+                *e = 0;
+                float back = strtof(buf, NULL);
+                if ((bf16 ? float_to_bf16(back) : float_to_half(back)) == h) {
+                    memcpy(t.s, buf, e - buf);
+                    end = t.s + (e - buf);
+                    break;
+                }
+            }
+            if (!end)
+                end = put_f32(t.s, f);
+            t.len = end - t.s;
+        }
+    }
+
+    const text &operator[](uint16_t h) const { return texts_[h]; }
+
+private:
+    text texts_[65536];
+};
+
+template<int TYPE>
+static const value_texts &texts_of()
+{
+    static const value_texts *texts = new value_texts(TYPE);
+    return *texts;
+}
+
+// raw holds value_bytes(type) bytes already in host order
+template<int TYPE>
+static inline char *put_value(char *out, uint32_t raw)
+{
+    switch (TYPE) {
+    case VALUE_F32:  return put_f32(out, bits_to_float(raw));
+    case VALUE_I32:  return put_i32(out, (int32_t)raw);
+    case VALUE_U32:  return put_u32(out, raw);
+    case VALUE_I8:   raw = (uint16_t)(int8_t)raw;   // fall through, as i16
+    case VALUE_I16:
+    case VALUE_F16:
+    case VALUE_BF16: {
+        const value_texts::text &t = texts_of<TYPE == VALUE_I8 ? VALUE_I16 : TYPE>()[raw];
+        memcpy(out, t.s, sizeof(t.s));
+        return out + t.len;
+    }
+    }
+    return out;
+}
+
+}
+
+#endif
@@ -0,0 +1,225 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: value_stats.h
+ *     Created: 2018-05-17 14:20
+ * Description: single pass statistics of typed numbers
+ * ===================================================
+ */
+#ifndef _KX_VALUE_STATS_H
+#define _KX_VALUE_STATS_H
+
+#include <stdint.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "file.h"
+#include "value_format.h"
+
+// histogram bins: the exponent field for floats, the bit length of the
+// magnitude for integers
+#define STATS_BINS 256
+
+namespace kx {
+
+struct value_stats {
+    uint64_t count = 0;
+    uint64_t zeros = 0;
+    uint64_t nans = 0;
+    uint64_t infs = 0;
+    double sum = 0;
+    double min = INFINITY;
+    double max = -INFINITY;
+    uint64_t hist[STATS_BINS] = {0};
+
+    void merge(const value_stats &o) {
+        count += o.count;
+        zeros += o.zeros;
+        nans += o.nans;
+        infs += o.infs;
+        sum += o.sum;
+        min = std::min(min, o.min);
+        max = std::max(max, o.max);
+        for (int i=0; i<STATS_BINS; i++)
+            hist[i] += o.hist[i];
+    }
+
+    // a finite value v falling in bin
+    void add(double v, int bin) {
+        count++;
+        zeros += v == 0;
+        sum += v;
+        min = std::min(min, v);
+        max = std::max(max, v);
+        hist[bin]++;
+    }
+
+    void add_float(float f) {
+        uint32_t bits = float_to_bits(f);
+        if ((bits & 0x7fffffff) >= 0x7f800000) {
+            count++;
+            nans += isnan(f);
+            infs += isinf(f);
+            hist[255]++;
+            return;
+        }
+        add(f, (bits >> 23) & 0xff);
+    }
+
+    void add_int(int64_t v) {
+        uint64_t m = v < 0 ? 0 - (uint64_t)v : v;
+        add(v, m ? 64 - __builtin_clzll(m) : 0);
+    }
+
+    void add_uint(uint64_t v) {
+        add(v, v ? 64 - __builtin_clzll(v) : 0);
+    }
+
+    // raw holds the N bytes of a number of type in host order; hex is
+    // counted as unsigned
+    template<int TYPE, int N>
+    void add_raw(uint64_t raw) {
+        switch (TYPE) {
+        case VALUE_F32:  add_float(bits_to_float(raw)); break;
+        case VALUE_F16:  add_float(half_to_float(raw)); break;
+        case VALUE_BF16: add_float(bf16_to_float(raw)); break;
+        case VALUE_I8:   add_int((int8_t)raw); break;
+        case VALUE_I16:  add_int((int16_t)raw); break;
+        case VALUE_I32:  add_int((int32_t)raw); break;
+        default:         add_uint(raw); break;
+        }
+    }
+
+    // n numbers of N bytes from p
+    template<int TYPE, int N>
+    void add_numbers(const char *p, size_t n, bool be) {
+        size_t i = 0;
+#ifdef __SSE2__
+        if (TYPE == VALUE_F32 && !be) {
+            add_f32(p, n - n % 4);
+            i = n - n % 4;
+        }
+#endif
+        if (TYPE == VALUE_F32 || TYPE == VALUE_F16 || TYPE == VALUE_BF16) {
+            for (; i<n; i++)
+                add_raw<TYPE, N>(load_number<N>(p + i*N, be));
+        } else {
+            add_integers<TYPE, N>(p + i*N, n - i, be);
+        }
+    }
+
+private:
+    // integers with the accumulators in locals, which the histogram
+    // stores can not alias
+    template<int TYPE, int N>
+    void add_integers(const char *p, size_t n, bool be) {
+        typedef typename std::conditional<TYPE == VALUE_I8 || TYPE == VALUE_I16 || TYPE == VALUE_I32,
+                int64_t, uint64_t>::type T;
+        T lo = std::numeric_limits<T>::max();
+        T hi = std::numeric_limits<T>::min();
+        uint64_t zero_count = 0;
+        double total = 0;
+
+        for (size_t i=0; i<n; i++) {
+            uint64_t raw = load_number<N>(p + i*N, be);
+            T v = TYPE == VALUE_I8 ? (int8_t)raw : TYPE == VALUE_I16 ? (int16_t)raw :
+                TYPE == VALUE_I32 ? (int32_t)raw : (T)raw;
+            uint64_t m = (int64_t)v < 0 && std::is_signed<T>::value ? 0 - (uint64_t)v : (uint64_t)v;
+
+            lo = std::min(lo, v);
+            hi = std::max(hi, v);
+            zero_count += v == 0;
+            total += v;
+            hist[m ? 64 - __builtin_clzll(m) : 0]++;
+        }
+
+        if (n) {
+            min = std::min(min, (double)lo);
+            max = std::max(max, (double)hi);
+        }
+        count += n;
+        zeros += zero_count;
+        sum += total;
+    }
+
+#ifdef __SSE2__
+    // Four floats per step: the class masks of a block are counted with
+    // movemask, non-finite lanes are replaced by the neutral value for
+    // min/max/sum, and only the histogram is updated lane by lane.
+    void add_f32(const char *p, size_t n) {
+        const __m128i abs_mask = _mm_set1_epi32(0x7fffffff);
+        const __m128i inf_bits = _mm_set1_epi32(0x7f800000);
+        const __m128 pos_inf = _mm_set1_ps(INFINITY);
+        const __m128 neg_inf = _mm_set1_ps(-INFINITY);
+        __m128 vmin = pos_inf, vmax = neg_inf;
+        __m128d sum_lo = _mm_setzero_pd(), sum_hi = _mm_setzero_pd();
+        uint64_t zero_count = 0, nan_count = 0, inf_count = 0;
+        uint32_t bits[4];
+
+        for (size_t i=0; i<n; i+=4) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + 4*i));
+            __m128i abs = _mm_and_si128(v, abs_mask);
+            __m128i nan = _mm_cmpgt_epi32(abs, inf_bits);
+            __m128i inf = _mm_cmpeq_epi32(abs, inf_bits);
+            __m128i zero = _mm_cmpeq_epi32(abs, _mm_setzero_si128());
+            __m128 finite = _mm_castsi128_ps(_mm_andnot_si128(_mm_or_si128(nan, inf), _mm_set1_epi32(-1)));
+            __m128 f = _mm_castsi128_ps(v);
+
+            vmin = _mm_min_ps(vmin, _mm_or_ps(_mm_and_ps(finite, f), _mm_andnot_ps(finite, pos_inf)));
+            vmax = _mm_max_ps(vmax, _mm_or_ps(_mm_and_ps(finite, f), _mm_andnot_ps(finite, neg_inf)));
+            __m128 ff = _mm_and_ps(finite, f);
+            sum_lo = _mm_add_pd(sum_lo, _mm_cvtps_pd(ff));
+            sum_hi = _mm_add_pd(sum_hi, _mm_cvtps_pd(_mm_movehl_ps(ff, ff)));
+
+            zero_count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(zero)));
+            nan_count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(nan)));
+            inf_count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(inf)));
+
+            _mm_storeu_si128((__m128i *)bits, v);
+            for (int k=0; k<4; k++)
+                hist[(bits[k] >> 23) & 0xff]++;
+        }
+
+        float lanes[4];
+        double sums[2];
+        _mm_storeu_ps(lanes, vmin);
+        for (int k=0; k<4; k++)
+            min = std::min(min, (double)lanes[k]);
+        _mm_storeu_ps(lanes, vmax);
+        for (int k=0; k<4; k++)
+            max = std::max(max, (double)lanes[k]);
+        _mm_storeu_pd(sums, _mm_add_pd(sum_lo, sum_hi));
+
+        count += n;
+        zeros += zero_count;
+        nans += nan_count;
+        infs += inf_count;
+        sum += sums[0] + sums[1];
+    }
+#endif
+};
+
+// "[2^e, 2^e+1)" style name of a histogram bin
+static std::string stats_bin_name(int bin, bool is_float)
+{
+    if (!is_float) {
+        if (bin == 0)
+            return "0";
+        return string_format("[2^%d, 2^%d)", bin - 1, bin);
+    }
+
+    if (bin == 0)
+        return "0 or subnormal";
+    if (bin == 255)
+        return "inf or nan";
+    return string_format("[2^%d, 2^%d)", bin - 127, bin - 126);
+}
+
+}
+
+#endif
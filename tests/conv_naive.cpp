@@ -0,0 +1,82 @@
+/* ===================================================
+ * Copyright (C) 2018 speed-clouds All Right Reserved.
+ *      Author: mincore@163.com
+ *    Filename: conv_naive.cpp
+ *     Created: 2018-05-15 11:20
+ * Description: direct loop conv for tests/reference_conv.sh
+ * ===================================================
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "../src/file.h"
+
+using namespace kx;
+
+// Writes random weight, bias and img files of a shape to dir, and
+// expect.bin, their conv computed with the direct loop in the layouts
+// of reference-conv. The numbers are multiples of 1/4 in [-4, 4], so
+// every product and sum is exact in float whatever the order, and the
+// output of reference-conv must be byte identical.
+int main(int argc, char **argv)
+{
+    if (argc != 9) {
+        printf("usage: %s dir dim inputs outputs imgh batch same_conv seed\n", argv[0]);
+        return 2;
+    }
+
+    std::string dir = argv[1];
+    int dim = atoi(argv[2]);
+    int inputs = atoi(argv[3]);
+    int outputs = atoi(argv[4]);
+    int img_h = atoi(argv[5]);
+    int batch = atoi(argv[6]);
+    int pad = atoi(argv[7]) ? (dim - 1)/2 : 0;
+    std::mt19937 rng(atoi(argv[8]));
+    std::uniform_int_distribution<int> quarter(-16, 16);
+
+    std::vector<float> w((size_t)outputs*inputs*dim*dim);
+    std::vector<float> b(outputs);
+    std::vector<float> img((size_t)batch*inputs*img_h*img_h);
+    for (auto &v: w)
+        v = quarter(rng) / 4.0f;
+    for (auto &v: b)
+        v = quarter(rng) / 4.0f;
+    for (auto &v: img)
+        v = quarter(rng) / 4.0f;
+
+    int out_h = img_h + 2*pad - dim + 1;
+    std::vector<float> out((size_t)batch*outputs*out_h*out_h);
+    float *o = &out[0];
+    for (int n=0; n<batch; n++) {
+        for (int oc=0; oc<outputs; oc++) {
+            for (int oy=0; oy<out_h; oy++) {
+                for (int ox=0; ox<out_h; ox++) {
+                    float sum = b[oc];
+                    for (int c=0; c<inputs; c++) {
+                        for (int ky=0; ky<dim; ky++) {
+                            for (int kx=0; kx<dim; kx++) {
+                                int y = oy - pad + ky;
+                                int x = ox - pad + kx;
+                                if (y < 0 || y >= img_h || x < 0 || x >= img_h)
+                                    continue;
+                                sum += w[((size_t)(oc*inputs + c)*dim + ky)*dim + kx] *
+                                    img[((size_t)(n*inputs + c)*img_h + y)*img_h + x];
+                            }
+                        }
+                    }
+                    *o++ = sum;
+                }
+            }
+        }
+    }
+
+    if (write_file(dir + "/w.bin", w) < 0 || write_file(dir + "/b.bin", b) < 0 ||
+            write_file(dir + "/img.bin", img) < 0 || write_file(dir + "/expect.bin", out) < 0) {
+        printf("can not write to \"%s\"\n", dir.c_str());
+        return 1;
+    }
+    return 0;
+}
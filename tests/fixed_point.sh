@@ -0,0 +1,55 @@
+#!/bin/sh
+# emulate-conv and emulate-fc with the sse2 and avx2 accumulator lanes
+# against the scalar ones, on random words, for every rounding, wrapping
+# and saturating accumulators and outputs, and an accumulator narrow
+# enough to saturate on nearly every add. The lane counts leave tails of
+# every kernel width.
+MODEL=${MODEL:-./model}
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+fail=0
+
+lanes=sse2
+grep -qw avx2 /proc/cpuinfo && lanes="sse2 avx2"
+
+head -c $((5*7*3*3*4)) /dev/urandom > "$T/cw.bin"
+head -c $((5*4)) /dev/urandom > "$T/cb.bin"
+head -c $((2*7*13*13*4)) /dev/urandom > "$T/ci.bin"
+head -c $((19*37*4)) /dev/urandom > "$T/fw.bin"
+head -c $((19*4)) /dev/urandom > "$T/fb.bin"
+head -c $((83*37*4)) /dev/urandom > "$T/fx.bin"
+
+# runs "$@" with every lanes kernel into $T/<kernel>, compares them
+same_lanes() {
+    for l in scalar $lanes; do
+        if ! "$@" --lanes $l --output "$T/$l" > "$T/log"; then
+            echo "FAIL: --lanes $l $*"
+            cat "$T/log"
+            fail=1
+        fi
+    done
+    for l in $lanes; do
+        if ! cmp -s "$T/scalar" "$T/$l"; then
+            echo "FAIL: --lanes $l differs from scalar: $*"
+            fail=1
+        fi
+    done
+}
+
+for widths in "--acc-bits 48" "--acc-bits 24" "--data-bits 32 --frac-bits 12 --acc-bits 62" \
+        "--data-bits 12 --frac-bits 4 --acc-bits 20 --out-bits 8"; do
+    for round in floor trunc nearest even; do
+        for acc in wrap saturate; do
+            for out in saturate wrap; do
+                fx="$widths --round $round --acc-overflow $acc --out-overflow $out"
+                same_lanes "$MODEL" emulate-conv --weight "$T/cw.bin" --bias "$T/cb.bin" --input "$T/ci.bin" \
+                    --dim 3 --inputs 7 --outputs 5 --imgh 13 --batch 2 $fx
+                same_lanes "$MODEL" emulate-fc --weight "$T/fw.bin" --bias "$T/fb.bin" --input "$T/fx.bin" \
+                    --inputs 37 --outputs 19 --batch 83 $fx
+            done
+        done
+    done
+done
+
+[ $fail = 0 ] && echo "fixed point tests passed"
+exit $fail
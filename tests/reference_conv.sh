@@ -0,0 +1,32 @@
+#!/bin/sh
+# reference-conv against the direct loop of tests/conv_naive on small
+# shapes, valid and --same-conv: every dim, output and pixel counts that
+# are not multiples of the 4x2 kernel or of CONV_NB, and k past GEMM_KC
+MODEL=${MODEL:-./model}
+CONV_NAIVE=${CONV_NAIVE:-tests/conv_naive}
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+fail=0
+seed=1
+
+# dim inputs outputs imgh batch
+for shape in "1 1 1 1 1" "1 3 5 6 2" "3 1 1 3 1" "3 2 7 9 2" "3 40 6 5 1" \
+        "5 3 4 7 1" "5 2 9 11 3" "7 1 3 7 1" "7 4 5 12 2"; do
+    set -- $shape
+    for same in 0 1; do
+        opt=
+        [ $same = 1 ] && opt=--same-conv
+        seed=$((seed + 1))
+        "$CONV_NAIVE" "$T" $1 $2 $3 $4 $5 $same $seed || exit 1
+        if ! "$MODEL" reference-conv --weight "$T/w.bin" --bias "$T/b.bin" --input "$T/img.bin" \
+                --output "$T/out.bin" --dim $1 --inputs $2 --outputs $3 --imgh $4 --batch $5 $opt > "$T/log" ||
+                ! cmp -s "$T/expect.bin" "$T/out.bin"; then
+            echo "FAIL: dim $1 inputs $2 outputs $3 imgh $4 batch $5 $opt"
+            cat "$T/log"
+            fail=1
+        fi
+    done
+done
+
+[ $fail = 0 ] && echo "reference-conv tests passed"
+exit $fail
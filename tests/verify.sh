@@ -0,0 +1,32 @@
+#!/bin/sh
+# model verify on files whose size is not a multiple of -b, differing in
+# the partial number at the end
+MODEL=${MODEL:-./model}
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+fail=0
+
+expect() {
+    if ! grep -q "$1" "$T/out"; then
+        echo "FAIL: $2: expected \"$1\""
+        cat "$T/out"
+        fail=1
+    fi
+}
+
+head -c 4094 /dev/zero > "$T/a.bin"
+cp "$T/a.bin" "$T/b.bin"
+printf '\001' | dd of="$T/b.bin" bs=1 seek=4093 conv=notrunc 2>/dev/null
+
+"$MODEL" verify --input "$T/a.bin" --golden "$T/a.bin" > "$T/out"
+expect "0 mismatches in 1024 numbers" "same files"
+
+"$MODEL" verify --input "$T/a.bin" --golden "$T/b.bin" > "$T/out"
+expect "addr 0x000003ff: 0000 != 0100" "tail difference"
+expect "1 mismatches in 1024 numbers" "tail difference"
+
+"$MODEL" verify -b 8 --input "$T/a.bin" --golden "$T/b.bin" > "$T/out"
+expect "1 mismatches in 512 numbers" "tail difference, -b 8"
+
+[ $fail = 0 ] && echo "verify tests passed"
+exit $fail